@@ -1,11 +1,140 @@
 #pragma once
+#include <cstddef>
 #include <cstdint>
+#include <type_traits>
 
 namespace klib {
 
 // data: the num word data vector
 // num: data length, > 0 for encode, < 0 for decode
 // key: the 4 word key
+// the common sizes 4, 8, 16 and 32 go to btea<N>
 void btea(uint32_t* data, int32_t num, const uint32_t key[4]);
 
+inline uint32_t btea_mx(uint32_t y, uint32_t z, uint32_t sum, uint32_t p, uint32_t e, const uint32_t key[4]) noexcept
+{
+    return ((z >> 5 ^ y << 2) + (y >> 3 ^ z << 4)) ^ ((sum ^ y) + (key[(p & 3) ^ e] ^ z));
+}
+
+// one encoding round from word P to the last word
+template <uint32_t N, uint32_t P, bool Last = P + 1 == N>
+struct btea_encode_round {
+    static void run(uint32_t* data, uint32_t& z, uint32_t sum, uint32_t e, const uint32_t key[4]) noexcept
+    {
+        z = data[P] += btea_mx(data[P + 1], z, sum, P, e, key);
+        btea_encode_round<N, P + 1>::run(data, z, sum, e, key);
+    }
+};
+
+template <uint32_t N, uint32_t P>
+struct btea_encode_round<N, P, true> {
+    static void run(uint32_t* data, uint32_t& z, uint32_t sum, uint32_t e, const uint32_t key[4]) noexcept
+    {
+        z = data[P] += btea_mx(data[0], z, sum, P, e, key);
+    }
+};
+
+// one decoding round from word P down to the first word
+template <uint32_t N, uint32_t P, bool Last = 0 == P>
+struct btea_decode_round {
+    static void run(uint32_t* data, uint32_t& y, uint32_t sum, uint32_t e, const uint32_t key[4]) noexcept
+    {
+        y = data[P] -= btea_mx(y, data[P - 1], sum, P, e, key);
+        btea_decode_round<N, P - 1>::run(data, y, sum, e, key);
+    }
+};
+
+template <uint32_t N, uint32_t P>
+struct btea_decode_round<N, P, true> {
+    static void run(uint32_t* data, uint32_t& y, uint32_t sum, uint32_t e, const uint32_t key[4]) noexcept
+    {
+        y = data[0] -= btea_mx(y, data[N - 1], sum, 0, e, key);
+    }
+};
+
+// btea with the word count fixed at compile time, N as num of btea.
+// the round count and the word loop are constants, so every round is
+// unrolled. gives the same result as btea(data, N, key).
+template <int32_t N>
+typename std::enable_if<(N > 1)>::type btea(uint32_t* data, const uint32_t key[4]) noexcept
+{
+    uint32_t sum = 0;
+    uint32_t z = data[N - 1];
+    for (uint32_t rounds = 6 + 52 / N; rounds > 0; --rounds) {
+        sum += 0x9e3779b9;
+        btea_encode_round<N, 0>::run(data, z, sum, (sum >> 2) & 3, key);
+    }
+}
+
+template <int32_t N>
+typename std::enable_if<(N < -1)>::type btea(uint32_t* data, const uint32_t key[4]) noexcept
+{
+    const uint32_t rounds = 6 + 52 / -N;
+    uint32_t sum = rounds * 0x9e3779b9;
+    uint32_t y = data[0];
+    for (uint32_t i = 0; i < rounds; ++i, sum -= 0x9e3779b9)
+        btea_decode_round<-N, -N - 1>::run(data, y, sum, (sum >> 2) & 3, key);
+}
+
+// byte oriented btea for buffers of any alignment and size. the plain
+// text is padded with 0x80 and zeros to a whole number of words, at
+// least 8 bytes, and encrypted in place.
+
+// size of the encrypted buffer for size plain bytes
+size_t btea_padded_size(size_t size) noexcept;
+
+// data: size plain bytes in a buffer of capacity bytes
+// return: the padded size now holding the cipher text, 0 if capacity is
+// less than btea_padded_size(size)
+size_t btea_encrypt_bytes(void* data, size_t size, size_t capacity, const uint32_t key[4]);
+
+// data: size bytes of cipher text, decrypted in place
+// plain_size: the plain text length without the padding
+// return: false if size or the padding is not valid, data is left
+// decrypted when only the padding is not
+bool btea_decrypt_bytes(void* data, size_t size, const uint32_t key[4], size_t& plain_size);
+
+// sealed packets: the btea_encrypt_bytes cipher text followed by the
+// crc32 of the cipher text, 4 bytes little endian. the crc is computed
+// while the last round writes the cipher text, and checked before any
+// decryption work when opening.
+
+// size of the sealed packet for size plain bytes
+size_t btea_sealed_size(size_t size) noexcept;
+
+// data: size plain bytes in a buffer of capacity bytes
+// return: the sealed packet size, 0 if capacity is less than
+// btea_sealed_size(size)
+size_t btea_seal(void* data, size_t size, size_t capacity, const uint32_t key[4]);
+
+// data: a sealed packet of size bytes, decrypted in place
+// return: false if the crc or the padding does not match, the data is
+// left untouched on a crc mismatch
+bool btea_open(void* data, size_t size, const uint32_t key[4], size_t& plain_size);
+
+// data: count vectors of |num| words each
+// num: as in btea, the same for every vector
+// keys: count 4 word keys, keys[i] is used for data[i]
+// gives the same result as btea(data[i], num, keys[i]) for each i, but
+// runs 4 (sse2) or 8 (avx2) vectors side by side in simd lanes
+void btea_batch(uint32_t* const* data, size_t count, int32_t num, const uint32_t* const* keys);
+
+// counter mode on top of btea. keystream block n (16 bytes) is the btea
+// encryption of the words { nonce, nonce >> 32, n, n >> 32 }, so every
+// byte range can be encrypted or decrypted on its own: one record of a
+// large file is read without touching the rest, and ranges can be
+// processed in parallel. encryption and decryption are the same xor.
+// a nonce must never be reused with the same key.
+class btea_ctr {
+public:
+    btea_ctr(const uint32_t key[4], uint64_t nonce) noexcept;
+
+    // data: size bytes located at byte offset of the whole stream
+    void crypt(void* data, size_t size, uint64_t offset) const;
+
+private:
+    uint32_t _key[4];
+    uint64_t _nonce;
+};
+
 } // namespace klib
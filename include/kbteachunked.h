@@ -0,0 +1,32 @@
+#pragma once
+#include "kbtea.h"
+#include "kstream.h"
+#include "kworker.h"
+
+namespace klib {
+
+// chunked btea format for large buffers:
+//   header: magic "KBTC", chunk words (u32), plain size (u64), little endian
+//   chunks: the plain text split into chunks of chunk words, each one
+//           encrypted with btea on its own. the last chunk is zero padded
+//           to a whole number of words, at least 2.
+// the chunks are independent, so they are encrypted and decrypted in
+// parallel on a worker_pool. equal chunks give equal ciphertext, use
+// btea_ctr when that must be hidden.
+
+const size_t btea_chunked_header_size = 16;
+
+// size of the chunked ciphertext of size plain bytes
+size_t btea_chunked_size(size_t size, size_t chunk_words) noexcept;
+
+// appends the chunked ciphertext of data to out
+// chunk_words: > 1
+void btea_encrypt_chunked(const void* data, size_t size, const uint32_t key[4],
+    memstream& out, worker_pool& pool, size_t chunk_words = 16384);
+
+// appends the plain text of a chunked ciphertext to out
+// return: false if data is not a valid chunked ciphertext, out is unchanged
+bool btea_decrypt_chunked(const void* data, size_t size, const uint32_t key[4],
+    memstream& out, worker_pool& pool);
+
+} // namespace klib
@@ -0,0 +1,67 @@
+#pragma once
+#include "kbtea.h"
+#include "kstream.h"
+#include <vector>
+
+namespace klib {
+
+// encrypts everything written with btea in chunks of chunk_words words
+// and forwards the ciphertext to stream. the last chunk is padded with
+// 0x80 followed by zeros, a full padding chunk is added when the data
+// ends on a chunk boundary, so the output is always a multiple of the
+// chunk size and at least one chunk long.
+class btea_wstream : public wstream {
+public:
+    // chunk_words: > 1
+    btea_wstream(wstream& stream, const uint32_t key[4], size_t chunk_words = 64);
+    ~btea_wstream() override = default;
+    btea_wstream(const btea_wstream&) = delete;
+    btea_wstream& operator=(const btea_wstream&) = delete;
+
+    using wstream::write;
+    bool write(const void* data, size_t size) override;
+
+    // pads and writes the last chunk, call it once after the last write
+    bool finish();
+
+private:
+    bool write_chunk();
+
+private:
+    wstream& _stream;
+    uint32_t _key[4];
+    std::vector<uint32_t> _chunk;
+    size_t _used = 0;
+};
+
+// decrypts the output of btea_wstream read from stream. the chunk read
+// when stream has no data left is the last one and gets its padding
+// removed, so stream must end where the ciphertext ends.
+class btea_rstream : public rstream {
+public:
+    // chunk_words: the same as on the writing side
+    btea_rstream(rstream& stream, const uint32_t key[4], size_t chunk_words = 64);
+    ~btea_rstream() override = default;
+    btea_rstream(const btea_rstream&) = delete;
+    btea_rstream& operator=(const btea_rstream&) = delete;
+
+    using rstream::peek;
+    using rstream::read;
+    bool peek(void* data, size_t size) override;
+    bool discard(size_t size) override;
+    bool read(void* data, size_t size) override;
+
+private:
+    // decrypts chunks until size plain bytes are buffered
+    bool fill(size_t size);
+    bool read_chunk();
+
+private:
+    rstream& _stream;
+    uint32_t _key[4];
+    std::vector<uint32_t> _chunk;
+    memstream _plain;
+    bool _finished = false;
+};
+
+} // namespace klib
@@ -1,43 +1,274 @@
 #pragma once
+#include <atomic>
 #include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <vector>
 
 namespace klib {
 
+class worker_pool;
+class wstream;
+
+// a match in a text
+struct censor_span {
+    size_t offset;
+    size_t length;
+    uint32_t word; // the word id
+};
+
+// return: false to stop the scan
+using censor_callback = bool (*)(void* context, const censor_span& span);
+
+// the first bytes of the words, used by the scans to skip text that
+// cannot start a word. lo and hi are nibble tables for a simd test that
+// may also let through bytes outside of bits.
+struct censor_prefilter {
+    uint64_t bits[4] = {};
+    uint8_t lo[16] = {};
+    uint8_t hi[16] = {};
+
+    void add(unsigned char c) noexcept
+    {
+        bits[c >> 6] |= uint64_t(1) << (c & 63);
+        lo[c & 0x0f] |= static_cast<uint8_t>(1 << ((c >> 4) & 7));
+        hi[c >> 4] = static_cast<uint8_t>(1 << ((c >> 4) & 7));
+    }
+    bool test(unsigned char c) const noexcept
+    {
+        return 0 != (bits[c >> 6] & (uint64_t(1) << (c & 63)));
+    }
+};
+
+// folding of the text while matching, so that variants of a word match
+// without making a normalized copy of the text. a code point is folded
+// from full width to half width, then by the homoglyph table, then to
+// lower case. skipped code points are ignored inside a word, so
+// "f.u.c.k" matches "fuck", but never start one. the words themselves
+// are matched as added, fold them with apply.
+struct censor_fold {
+    enum : uint32_t {
+        skip_space = 1, // ascii white space and U+3000
+        skip_punct = 2, // ascii punctuation
+    };
+
+    bool lower_case = true; // A-Z to a-z
+    bool half_width = true; // U+FF01..U+FF5E to ascii, U+3000 to space
+    uint32_t skip_classes = 0;
+
+    // folds from to to, taking precedence over skipping from
+    void map(uint32_t from, uint32_t to);
+    // skips cp inside words
+    void skip(uint32_t cp);
+
+    uint32_t fold(uint32_t cp) const noexcept;
+    bool skipped(uint32_t cp) const noexcept;
+
+    // the folded word without skipped code points, for add_word
+    std::string apply(const std::string& word) const;
+
+private:
+    std::vector<std::pair<uint32_t, uint32_t>> _map; // sorted by from
+    std::vector<uint32_t> _skip; // sorted
+};
+
 class censor {
 public:
     censor()
+        : _nodes(1)
     {
-        _root = new node();
-    }
-    ~censor()
-    {
-        delete _root;
     }
     censor(const censor&) = delete;
     censor& operator=(const censor&) = delete;
 
-    void add_word(const std::string& word);
+    // adding a word drops the compiled automaton. throws
+    // std::length_error when the trie outgrows 32-bit node indices.
+    // return: the word id, ids count up from 0 in the order words are
+    // first added
+    uint32_t add_word(const std::string& word);
+
+    // builds aho-corasick failure links over the words added so far, so
+    // has_word and filter_word scan a sentence in one pass instead of
+    // restarting at every utf-8 character. the matches are the same.
+    void compile();
+    bool compiled() const noexcept
+    {
+        return _compiled;
+    }
+
     bool has_word(const std::string& sentence) const noexcept;
     bool filter_word(std::string& sentence, char replace = '*') const noexcept;
 
+    // has_word, filter_word and find_words on the folded text, the spans
+    // cover the original bytes including skipped code points. scans with
+    // the trie at every lattice position, compiled or not.
+    bool has_word(const std::string& sentence, const censor_fold& fold) const noexcept;
+    bool filter_word(std::string& sentence, const censor_fold& fold, char replace = '*') const noexcept;
+    size_t find_words(const char* text, size_t size, const censor_fold& fold, censor_span* spans,
+        size_t capacity) const noexcept;
+
+    // has_word and filter_word over count messages at once, spread over
+    // pool. each task collects its verdicts on its own stack and stores
+    // them in one go, so threads do not write to shared cache lines.
+    // verdicts: count results, optional for filter_word_batch
+    void has_word_batch(const std::string* messages, size_t count, bool* verdicts, worker_pool& pool) const;
+    void filter_word_batch(std::string* messages, size_t count, bool* verdicts, worker_pool& pool,
+        char replace = '*') const;
+
+    // the matches filter_word replaces, in text order, without changing
+    // the text, so one scan serves any kind of replacement or report.
+    // nothing is allocated unless a word is longer than 256 bytes.
+    // return: the number of matches, the first capacity of them are
+    // stored in spans
+    size_t find_words(const char* text, size_t size, censor_span* spans, size_t capacity) const noexcept;
+    // the same matches passed to fn one by one
+    // return: the number of matches passed to fn
+    size_t for_each_word(const char* text, size_t size, censor_callback fn, void* context) const noexcept;
+
+    // fn: called as bool fn(const censor_span&)
+    template <typename F>
+    size_t for_each_word(const char* text, size_t size, F& fn) const noexcept
+    {
+        return for_each_word(
+            text, size, [](void* context, const censor_span& span) { return (*static_cast<F*>(context))(span); }, &fn);
+    }
+
+    // bytes held by the trie
+    size_t memory_usage() const noexcept;
+
+    // writes the compiled dictionary in the censor_file format
+    // return: false if not compiled or the write fails
+    bool save(wstream& w) const;
+
 private:
-    bool is_word(const std::string& word, size_t pos, size_t* end = nullptr) const noexcept;
+    friend class censor_matcher;
+
+    template <typename Emit>
+    bool scan(const char* s, size_t n, bool first, Emit&& emit) const noexcept;
+    template <typename Emit>
+    bool scan_folded(const char* s, size_t n, const censor_fold& fold, bool first, Emit&& emit) const noexcept;
 
 private:
+    // the nodes live in one arena and refer to each other by index. the
+    // root is node 0, which also stands for no node, as no link leads to
+    // the root. the children of a node are kept in byte order in _links
+    // from first on, only for the bytes set in bits, the child of byte c
+    // is at the rank of c in bits. a full child list moves to the end of
+    // _links with twice the room, leaving its old slots unused.
     struct node {
-        node* nodes[0xff] = {};
+        uint64_t bits[4] = {};
+        uint32_t first = 0;
+        uint32_t fail = 0; // longest proper suffix in the trie
+        uint32_t dict = 0; // longest proper suffix that is a word
+        uint32_t depth = 0;
+        uint32_t word = 0; // id if isword
+        uint16_t room = 0; // slots at first
         bool isword = false;
-
-        ~node()
-        {
-            for (auto n : nodes) {
-                if (nullptr != n)
-                    delete n;
-            }
-        }
     };
-    node* _root = nullptr;
+    struct node_trie;
+
+    static uint32_t child(const node* nodes, const uint32_t* links, uint32_t n, unsigned char c) noexcept;
+    uint32_t child(uint32_t n, unsigned char c) const noexcept
+    {
+        return child(_nodes.data(), _links.data(), n, c);
+    }
+    uint32_t add_child(uint32_t n, unsigned char c);
+
+    std::vector<node> _nodes;
+    std::vector<uint32_t> _links;
+    size_t _depth = 0; // longest word
+    uint32_t _words = 0;
+    censor_prefilter _first;
+    bool _compiled = false;
+};
+
+// matches a text fed in chunks, as one for_each_word over all of it.
+// it keeps no automaton state between the feeds, only the bytes that may
+// still be part of a match, at most the longest word and a few more,
+// and scans them again with the bytes of the next feed. the censor must
+// outlive the matcher and not change while it is used.
+class censor_matcher {
+public:
+    explicit censor_matcher(const censor& c) noexcept
+        : _censor(&c)
+    {
+    }
+
+    // passes the matches that no later bytes can change to fn, with
+    // offsets from the start of the stream. when fn returns false the
+    // rest of the bytes are scanned again by the next feed or finish.
+    // return: the number of matches passed to fn
+    size_t feed(const char* data, size_t size, censor_callback fn, void* context);
+    // the end of the stream: passes all the remaining matches, whatever
+    // fn returns, and starts a new stream at the current offset
+    size_t finish(censor_callback fn, void* context);
+    // starts a new stream at offset 0
+    void reset() noexcept;
+
+    // fn: called as bool fn(const censor_span&)
+    template <typename F>
+    size_t feed(const char* data, size_t size, F& fn)
+    {
+        return feed(data, size, [](void* context, const censor_span& span) { return (*static_cast<F*>(context))(span); }, &fn);
+    }
+    template <typename F>
+    size_t finish(F& fn)
+    {
+        return finish([](void* context, const censor_span& span) { return (*static_cast<F*>(context))(span); }, &fn);
+    }
+
+    // the bytes fed so far
+    size_t offset() const noexcept
+    {
+        return _base + _pending.size();
+    }
+    // no match passed later reaches before this offset
+    size_t committed() const noexcept
+    {
+        return _base;
+    }
+
+private:
+    size_t scan(size_t limit, censor_callback fn, void* context);
+
+private:
+    const censor* _censor;
+    std::string _pending;
+    size_t _base = 0; // offset of _pending
+};
+
+// a compiled dictionary that is never changed again, so any number of
+// threads can match against it
+using censor_snapshot = std::shared_ptr<const censor>;
+
+censor_snapshot make_censor_snapshot(const std::vector<std::string>& words);
+
+// holds the current snapshot for hot reloading. readers never block or
+// take a lock: they announce themselves on one of two counters while
+// copying the shared_ptr. store swaps the pointer and waits for both
+// counters to drain, flipping readers over to the other one first so
+// new readers cannot starve it. an old snapshot is freed when its last
+// reader drops it.
+class censor_holder {
+public:
+    explicit censor_holder(censor_snapshot snapshot = nullptr);
+    ~censor_holder();
+    censor_holder(const censor_holder&) = delete;
+    censor_holder& operator=(const censor_holder&) = delete;
+
+    censor_snapshot load() const noexcept;
+    void store(censor_snapshot snapshot);
+
+private:
+    void wait_readers(unsigned parity) const noexcept;
+
+private:
+    std::atomic<censor_snapshot*> _current;
+    mutable std::atomic<size_t> _readers[2];
+    std::atomic<unsigned> _parity { 0 };
+    std::mutex _mutex;
 };
 
 } // namespace klib
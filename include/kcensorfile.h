@@ -0,0 +1,90 @@
+#pragma once
+#include "kcensor.h"
+
+namespace klib {
+
+// compiled censor dictionary file, written by censor::save and matched
+// in place without parsing, e.g. mapped with censor_file so that every
+// process shares the same pages. positions are node indices, so the
+// file works at any address:
+//   censor_file_header
+//   censor_file_node[nodes], breadth first from the root at index 0, the
+//   children of a node are consecutive in byte order
+// fields are in host byte order, the magic does not match on a host of
+// the other byte order.
+
+const uint32_t censor_file_magic = 0x4453434b; // "KCSD"
+const uint32_t censor_file_version = 2;
+const uint32_t censor_file_word = 0x80000000; // depth flag of word nodes
+
+struct censor_file_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t nodes;
+    uint32_t depth; // longest word
+    uint32_t crc; // crc32 of the nodes
+    uint32_t reserved;
+    uint64_t size; // header and nodes
+};
+
+struct censor_file_node {
+    uint64_t bits[4]; // child bytes
+    uint32_t first; // index of the first child
+    uint32_t fail;
+    uint32_t dict; // 0 for none
+    uint32_t depth; // | censor_file_word
+    uint32_t word; // id of a word node
+    uint32_t reserved;
+};
+
+// matches against a compiled dictionary in memory, the same as a compiled
+// censor. the data is not copied and must outlive the view.
+class censor_view {
+public:
+    // data: the file contents, 8 byte aligned
+    // verify: check the crc and every node link, otherwise only the header
+    bool open(const void* data, size_t size, bool verify = true) noexcept;
+    bool valid() const noexcept
+    {
+        return nullptr != _nodes;
+    }
+
+    bool has_word(const std::string& sentence) const noexcept;
+    bool filter_word(std::string& sentence, char replace = '*') const noexcept;
+
+    // as censor::find_words and censor::for_each_word
+    size_t find_words(const char* text, size_t size, censor_span* spans, size_t capacity) const noexcept;
+    size_t for_each_word(const char* text, size_t size, censor_callback fn, void* context) const noexcept;
+
+private:
+    struct flat_trie;
+
+    const censor_file_node* _nodes = nullptr;
+    size_t _count = 0;
+    size_t _depth = 0;
+    censor_prefilter _first;
+};
+
+// a compiled dictionary file mapped read only
+class censor_file {
+public:
+    censor_file() = default;
+    ~censor_file();
+    censor_file(const censor_file&) = delete;
+    censor_file& operator=(const censor_file&) = delete;
+
+    bool open(const char* path, bool verify = true);
+    void close() noexcept;
+
+    const censor_view& view() const noexcept
+    {
+        return _view;
+    }
+
+private:
+    void* _data = nullptr;
+    size_t _size = 0;
+    censor_view _view;
+};
+
+} // namespace klib
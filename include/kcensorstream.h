@@ -0,0 +1,53 @@
+#pragma once
+#include "kcensor.h"
+#include "kstream.h"
+#include <string>
+
+namespace klib {
+
+// reads stream with the words of a censor replaced, as filter_word over
+// all of it. the bytes that may still be part of a match are held back
+// until more is read, so a word split across reads is still found. the
+// data read when stream has no full chunk left is read in smaller
+// pieces down to single bytes, so stream must fail reads past its end
+// without consuming anything, as memstream does.
+class censor_rstream : public rstream {
+public:
+    // chunk_size: bytes read from stream at a time, > 0
+    censor_rstream(rstream& stream, const censor& c, char replace = '*', size_t chunk_size = 4096);
+    ~censor_rstream() override = default;
+    censor_rstream(const censor_rstream&) = delete;
+    censor_rstream& operator=(const censor_rstream&) = delete;
+
+    using rstream::peek;
+    using rstream::read;
+    bool peek(void* data, size_t size) override;
+    bool discard(size_t size) override;
+    bool read(void* data, size_t size) override;
+
+    // the matches found so far
+    size_t matches() const noexcept
+    {
+        return _matches;
+    }
+
+private:
+    // filters chunks until size bytes are ready
+    bool fill(size_t size);
+    bool read_chunk();
+    // moves the bytes before the committed offset of the matcher to _plain
+    bool release();
+
+private:
+    rstream& _stream;
+    censor_matcher _matcher;
+    std::string _chunk;
+    std::string _window; // the bytes from _released on, matches replaced
+    size_t _released = 0;
+    memstream _plain;
+    size_t _matches = 0;
+    char _replace;
+    bool _finished = false;
+};
+
+} // namespace klib
@@ -0,0 +1,185 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+namespace klib {
+
+template <size_t... I>
+struct crc_index_sequence {
+};
+
+template <size_t N, size_t... I>
+struct crc_make_index_sequence : crc_make_index_sequence<N - 1, N - 1, I...> {
+};
+
+template <size_t... I>
+struct crc_make_index_sequence<0, I...> {
+    using type = crc_index_sequence<I...>;
+};
+
+template <typename T>
+constexpr T crc_reflect(T v, unsigned bits, T r = 0)
+{
+    return 0 == bits ? r : crc_reflect(static_cast<T>(v >> 1), bits - 1, static_cast<T>((r << 1) | (v & 1)));
+}
+
+// compile-time lookup tables of a crc whose width is the bit width of T.
+// slice[k][n] is the crc register after byte n followed by k zero bytes.
+template <typename T, T Poly, bool Reflect>
+struct crc_table_generator {
+    static constexpr unsigned width = sizeof(T) * 8;
+    static constexpr size_t slices = 16;
+    static constexpr T reflected_poly = crc_reflect<T>(Poly, width);
+
+    struct table_type {
+        T slice[slices][0x100];
+    };
+
+    static constexpr T step(T v)
+    {
+        return Reflect
+            ? static_cast<T>((v & 1) ? (v >> 1) ^ reflected_poly : (v >> 1))
+            : static_cast<T>((v >> (width - 1)) ? (v << 1) ^ Poly : (v << 1));
+    }
+
+    static constexpr T steps(T v, unsigned n)
+    {
+        return 0 == n ? v : steps(step(v), n - 1);
+    }
+
+    static constexpr T byte_entry(size_t n)
+    {
+        return steps(Reflect ? static_cast<T>(n) : static_cast<T>(static_cast<T>(n) << (width - 8)), 8);
+    }
+
+    struct row_type {
+        T entry[0x100];
+    };
+
+    template <size_t... I>
+    static constexpr row_type make_row(crc_index_sequence<I...>)
+    {
+        return row_type { { byte_entry(I)... } };
+    }
+
+    // the single byte table, the other slices are derived from it
+    static constexpr row_type bytes = make_row(typename crc_make_index_sequence<0x100>::type {});
+
+    // advances a register by one zero byte
+    static constexpr T zero_byte(T v)
+    {
+        return Reflect
+            ? static_cast<T>((width > 8 ? (v >> 8) : 0) ^ bytes.entry[v & 0xff])
+            : static_cast<T>((width > 8 ? static_cast<T>(v << 8) : 0) ^ bytes.entry[(v >> (width - 8)) & 0xff]);
+    }
+
+    static constexpr T entry(size_t k, size_t n)
+    {
+        return 0 == k ? bytes.entry[n] : zero_byte(entry(k - 1, n));
+    }
+
+    template <size_t... I>
+    static constexpr table_type make(crc_index_sequence<I...>)
+    {
+        return table_type { {
+            { entry(0, I)... }, { entry(1, I)... }, { entry(2, I)... }, { entry(3, I)... },
+            { entry(4, I)... }, { entry(5, I)... }, { entry(6, I)... }, { entry(7, I)... },
+            { entry(8, I)... }, { entry(9, I)... }, { entry(10, I)... }, { entry(11, I)... },
+            { entry(12, I)... }, { entry(13, I)... }, { entry(14, I)... }, { entry(15, I)... },
+        } };
+    }
+
+    static constexpr table_type table = make(typename crc_make_index_sequence<0x100>::type {});
+};
+
+template <typename T, T Poly, bool Reflect>
+constexpr typename crc_table_generator<T, Poly, Reflect>::row_type crc_table_generator<T, Poly, Reflect>::bytes;
+template <typename T, T Poly, bool Reflect>
+constexpr typename crc_table_generator<T, Poly, Reflect>::table_type crc_table_generator<T, Poly, Reflect>::table;
+
+// table driven crc of width 8, 16, 32 or 64 (the bit width of T)
+// Poly: the normal (msb-first) polynomial without the leading term
+// Reflect: input and output bit reflection, as in most crc32 variants
+// Init/XorOut: register preset and final xor
+template <typename T, T Poly, bool Reflect, T Init, T XorOut>
+class crc_engine {
+    using generator = crc_table_generator<T, Poly, Reflect>;
+
+public:
+    using value_type = T;
+    static constexpr unsigned width = generator::width;
+    static constexpr T init = Init;
+    static constexpr T xorout = XorOut;
+
+    static constexpr const typename generator::table_type& table() noexcept
+    {
+        return generator::table;
+    }
+
+    // crc: the raw register, start with init
+    static T update(T crc, const void* data, size_t size) noexcept
+    {
+        const uint8_t* p = static_cast<const uint8_t*>(data);
+        for (; size >= 16; size -= 16, p += 16)
+            crc = fold<16, 0>(crc, p);
+        for (; size >= 8; size -= 8, p += 8)
+            crc = fold<8, 0>(crc, p);
+        for (; size > 0; --size, ++p)
+            crc = update_byte(crc, *p);
+        return crc;
+    }
+
+    static constexpr T update_byte(T crc, uint8_t c) noexcept
+    {
+        return Reflect
+            ? static_cast<T>((width > 8 ? (crc >> 8) : 0) ^ generator::table.slice[0][(crc ^ c) & 0xff])
+            : static_cast<T>((width > 8 ? static_cast<T>(crc << 8) : 0) ^ generator::table.slice[0][((crc >> (width - 8)) ^ c) & 0xff]);
+    }
+
+    static T calc(const void* data, size_t size) noexcept
+    {
+        return update(Init, data, size) ^ XorOut;
+    }
+
+    // byte at a time and usable in constant expressions, e.g. on literals
+    static constexpr T update_chars(T crc, const char* s, size_t n) noexcept
+    {
+        return 0 == n ? crc : update_chars(update_byte(crc, static_cast<uint8_t>(*s)), s + 1, n - 1);
+    }
+
+private:
+    // byte i of the register in stream order
+    static uint8_t reg_byte(T crc, size_t i) noexcept
+    {
+        return i >= width / 8 ? 0
+                              : static_cast<uint8_t>(Reflect ? crc >> (8 * i) : crc >> (width - 8 - 8 * i));
+    }
+
+    // consumes N >= width/8 bytes with one lookup per byte, unrolled
+    template <size_t N, size_t I>
+    static T fold(T crc, const uint8_t* p) noexcept
+    {
+        return fold_next<N, I>(crc, p, std::integral_constant<bool, I + 1 < N>())
+            ^ generator::table.slice[N - 1 - I][p[I] ^ reg_byte(crc, I)];
+    }
+
+    template <size_t N, size_t I>
+    static T fold_next(T crc, const uint8_t* p, std::true_type) noexcept
+    {
+        return fold<N, I + 1>(crc, p);
+    }
+
+    template <size_t N, size_t I>
+    static T fold_next(T, const uint8_t*, std::false_type) noexcept
+    {
+        return 0;
+    }
+};
+
+template <typename T, T Poly, bool Reflect, T Init, T XorOut>
+constexpr T crc_engine<T, Poly, Reflect, Init, XorOut>::init;
+template <typename T, T Poly, bool Reflect, T Init, T XorOut>
+constexpr T crc_engine<T, Poly, Reflect, Init, XorOut>::xorout;
+
+} // namespace klib
@@ -1,9 +1,72 @@
 #pragma once
 #include <cstddef>
 #include <cstdint>
+#include "kcrc.h"
+#ifndef _WIN32
+#include <sys/uio.h>
+#endif
 
 namespace klib {
 
+// crc-32 (ieee 802.3, zlib)
+using crc32_engine = crc_engine<uint32_t, 0x04c11db7, true, 0xffffffff, 0xffffffff>;
+// crc-32c (castagnoli, iscsi)
+using crc32c_engine = crc_engine<uint32_t, 0x1edc6f41, true, 0xffffffff, 0xffffffff>;
+
 uint32_t calc_crc32(const void* data, size_t size);
+uint32_t calc_crc32c(const void* data, size_t size);
+
+// calc_crc32 at compile time, e.g. message ids usable as case labels:
+// case crc32_literal("LoginReq"):
+constexpr uint32_t crc32_literal(const char* s, size_t n) noexcept
+{
+    return crc32_engine::update_chars(crc32_engine::init, s, n) ^ crc32_engine::xorout;
+}
+
+// the terminating '\0' of the literal is not part of the crc
+template <size_t N>
+constexpr uint32_t crc32_literal(const char (&s)[N]) noexcept
+{
+    return crc32_literal(s, N - 1);
+}
+
+struct crc32_buffer {
+    const void* data;
+    size_t size;
+};
+
+// crc32 of the concatenation of count buffers, without copying them
+uint32_t calc_crc32_buffers(const crc32_buffer* buffers, size_t count);
+#ifndef _WIN32
+uint32_t calc_crc32_iov(const struct iovec* iov, size_t count);
+#endif
+
+// crcs[i] = calc_crc32(buffers[i].data, buffers[i].size), computed with
+// several buffers interleaved to hide the table lookup latency
+void calc_crc32_batch(const crc32_buffer* buffers, size_t count, uint32_t* crcs);
+
+// incremental crc32: feeding the pieces of a buffer in order through
+// update() gives the same finalize() value as calc_crc32 over the whole
+class crc32_state {
+public:
+    void update(const void* data, size_t size) noexcept;
+    uint32_t finalize() const noexcept
+    {
+        return _crc ^ 0xffffffff;
+    }
+    void reset() noexcept
+    {
+        _crc = 0xffffffff;
+    }
+
+private:
+    uint32_t _crc = 0xffffffff;
+};
+
+// crc_a: crc32 of buffer a
+// crc_b: crc32 of buffer b
+// len_b: length of buffer b in bytes
+// return: crc32 of a followed by b
+uint32_t crc32_combine(uint32_t crc_a, uint32_t crc_b, size_t len_b) noexcept;
 
 } // namespace klib
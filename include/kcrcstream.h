@@ -0,0 +1,70 @@
+#pragma once
+#include "kcrc32.h"
+#include "kstream.h"
+
+namespace klib {
+
+// forwards writes to stream and keeps the crc32 of every byte written
+class crc_wstream : public wstream {
+public:
+    explicit crc_wstream(wstream& stream) noexcept
+        : _stream(stream)
+    {
+    }
+    ~crc_wstream() override = default;
+
+    using wstream::write;
+    bool write(const void* data, size_t size) override;
+
+    // appends the crc32 of the bytes written so far (4 bytes, little endian)
+    bool write_crc();
+
+    uint32_t crc() const noexcept
+    {
+        return _crc.finalize();
+    }
+    void reset_crc() noexcept
+    {
+        _crc.reset();
+    }
+
+private:
+    wstream& _stream;
+    crc32_state _crc;
+};
+
+// forwards reads to stream and keeps the crc32 of every byte consumed,
+// peeked bytes are not counted until they are read or discarded
+class crc_rstream : public rstream {
+public:
+    explicit crc_rstream(rstream& stream) noexcept
+        : _stream(stream)
+    {
+    }
+    ~crc_rstream() override = default;
+
+    using rstream::peek;
+    using rstream::read;
+    bool peek(void* data, size_t size) override;
+    bool discard(size_t size) override;
+    bool read(void* data, size_t size) override;
+
+    // reads a trailing crc32 written by crc_wstream::write_crc and checks
+    // it against the bytes consumed so far
+    bool check_crc();
+
+    uint32_t crc() const noexcept
+    {
+        return _crc.finalize();
+    }
+    void reset_crc() noexcept
+    {
+        _crc.reset();
+    }
+
+private:
+    rstream& _stream;
+    crc32_state _crc;
+};
+
+} // namespace klib
@@ -0,0 +1,54 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace klib {
+
+// a fixed set of threads that run parallel_for jobs
+class worker_pool {
+public:
+    // threads: threads taking part in a job including the caller of
+    // parallel_for, 0 for std::thread::hardware_concurrency()
+    explicit worker_pool(unsigned threads = 0);
+    ~worker_pool();
+    worker_pool(const worker_pool&) = delete;
+    worker_pool& operator=(const worker_pool&) = delete;
+
+    unsigned size() const noexcept
+    {
+        return static_cast<unsigned>(_threads.size()) + 1;
+    }
+
+    // calls fn(begin, end) on disjoint ranges covering [0, count) on the
+    // workers and the calling thread, returns when all ranges are done.
+    // a call from inside fn on the same pool runs on the calling thread
+    // alone. fn must not throw.
+    void parallel_for(size_t count, const std::function<void(size_t, size_t)>& fn);
+
+private:
+    void run() noexcept;
+    void work() noexcept;
+
+private:
+    std::vector<std::thread> _threads;
+    std::mutex _job_mutex;
+
+    std::mutex _mutex;
+    std::condition_variable _wake;
+    std::condition_variable _done;
+    const std::function<void(size_t, size_t)>* _fn = nullptr;
+    size_t _count = 0;
+    size_t _grain = 1;
+    std::atomic<size_t> _next { 0 };
+    size_t _busy = 0;
+    uint64_t _generation = 0;
+    bool _stop = false;
+};
+
+} // namespace klib
@@ -1,4 +1,11 @@
 #include "../include/kbtea.h"
+#include "../include/kcrc32.h"
+#include "kcpu.h"
+#include "kcrc32clmul.h"
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <vector>
 
 namespace klib {
 
@@ -6,6 +13,25 @@ namespace klib {
 #define MX (((z >> 5 ^ y << 2) + (y >> 3 ^ z << 4)) ^ ((sum ^ y) + (key[(p & 3) ^ e] ^ z)))
 void btea(uint32_t* data, int32_t num, const uint32_t key[4])
 {
+    switch (num) {
+    case 4:
+        return btea<4>(data, key);
+    case -4:
+        return btea<-4>(data, key);
+    case 8:
+        return btea<8>(data, key);
+    case -8:
+        return btea<-8>(data, key);
+    case 16:
+        return btea<16>(data, key);
+    case -16:
+        return btea<-16>(data, key);
+    case 32:
+        return btea<32>(data, key);
+    case -32:
+        return btea<-32>(data, key);
+    }
+
     uint32_t y, z, sum;
     uint32_t rounds, e;
     int32_t p;
@@ -41,4 +67,420 @@ void btea(uint32_t* data, int32_t num, const uint32_t key[4])
     }
 }
 
+#ifdef KLIB_X64
+
+namespace {
+
+// MX on 4 lanes
+inline __m128i mx_sse2(__m128i y, __m128i z, __m128i sum, __m128i key) noexcept
+{
+    const __m128i a = _mm_add_epi32(_mm_xor_si128(_mm_srli_epi32(z, 5), _mm_slli_epi32(y, 2)),
+        _mm_xor_si128(_mm_srli_epi32(y, 3), _mm_slli_epi32(z, 4)));
+    const __m128i b = _mm_add_epi32(_mm_xor_si128(sum, y), _mm_xor_si128(key, z));
+    return _mm_xor_si128(a, b);
+}
+
+// btea on 4 interleaved vectors: word p of lane l is v[p * 4 + l] and key
+// word j of lane l is k[j * 4 + l]
+void btea_sse2(uint32_t* v, int32_t num, const uint32_t* k) noexcept
+{
+    __m128i* w = reinterpret_cast<__m128i*>(v);
+    __m128i key[4];
+    for (int j = 0; j < 4; ++j)
+        key[j] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(k) + j);
+
+    __m128i y, z;
+    uint32_t sum, rounds, e;
+    int32_t p;
+    if (num > 1) { /* Coding Part */
+        rounds = 6 + 52 / num;
+        sum = 0;
+        z = _mm_loadu_si128(w + num - 1);
+        do {
+            sum += DELTA;
+            e = (sum >> 2) & 3;
+            const __m128i s = _mm_set1_epi32(static_cast<int>(sum));
+            for (p = 0; p < num - 1; p++) {
+                y = _mm_loadu_si128(w + p + 1);
+                z = _mm_add_epi32(_mm_loadu_si128(w + p), mx_sse2(y, z, s, key[(p & 3) ^ e]));
+                _mm_storeu_si128(w + p, z);
+            }
+            y = _mm_loadu_si128(w);
+            z = _mm_add_epi32(_mm_loadu_si128(w + num - 1), mx_sse2(y, z, s, key[(p & 3) ^ e]));
+            _mm_storeu_si128(w + num - 1, z);
+        } while (--rounds);
+    } else if (num < -1) { /* Decoding Part */
+        num = -num;
+        rounds = 6 + 52 / num;
+        sum = rounds * DELTA;
+        y = _mm_loadu_si128(w);
+        do {
+            e = (sum >> 2) & 3;
+            const __m128i s = _mm_set1_epi32(static_cast<int>(sum));
+            for (p = num - 1; p > 0; p--) {
+                z = _mm_loadu_si128(w + p - 1);
+                y = _mm_sub_epi32(_mm_loadu_si128(w + p), mx_sse2(y, z, s, key[(p & 3) ^ e]));
+                _mm_storeu_si128(w + p, y);
+            }
+            z = _mm_loadu_si128(w + num - 1);
+            y = _mm_sub_epi32(_mm_loadu_si128(w), mx_sse2(y, z, s, key[(p & 3) ^ e]));
+            _mm_storeu_si128(w, y);
+            sum -= DELTA;
+        } while (--rounds);
+    }
+}
+
+// MX on 8 lanes
+KLIB_TARGET("avx2")
+inline __m256i mx_avx2(__m256i y, __m256i z, __m256i sum, __m256i key) noexcept
+{
+    const __m256i a = _mm256_add_epi32(_mm256_xor_si256(_mm256_srli_epi32(z, 5), _mm256_slli_epi32(y, 2)),
+        _mm256_xor_si256(_mm256_srli_epi32(y, 3), _mm256_slli_epi32(z, 4)));
+    const __m256i b = _mm256_add_epi32(_mm256_xor_si256(sum, y), _mm256_xor_si256(key, z));
+    return _mm256_xor_si256(a, b);
+}
+
+// btea_sse2 with 8 lanes
+KLIB_TARGET("avx2")
+void btea_avx2(uint32_t* v, int32_t num, const uint32_t* k) noexcept
+{
+    __m256i* w = reinterpret_cast<__m256i*>(v);
+    __m256i key[4];
+    for (int j = 0; j < 4; ++j)
+        key[j] = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(k) + j);
+
+    __m256i y, z;
+    uint32_t sum, rounds, e;
+    int32_t p;
+    if (num > 1) { /* Coding Part */
+        rounds = 6 + 52 / num;
+        sum = 0;
+        z = _mm256_loadu_si256(w + num - 1);
+        do {
+            sum += DELTA;
+            e = (sum >> 2) & 3;
+            const __m256i s = _mm256_set1_epi32(static_cast<int>(sum));
+            for (p = 0; p < num - 1; p++) {
+                y = _mm256_loadu_si256(w + p + 1);
+                z = _mm256_add_epi32(_mm256_loadu_si256(w + p), mx_avx2(y, z, s, key[(p & 3) ^ e]));
+                _mm256_storeu_si256(w + p, z);
+            }
+            y = _mm256_loadu_si256(w);
+            z = _mm256_add_epi32(_mm256_loadu_si256(w + num - 1), mx_avx2(y, z, s, key[(p & 3) ^ e]));
+            _mm256_storeu_si256(w + num - 1, z);
+        } while (--rounds);
+    } else if (num < -1) { /* Decoding Part */
+        num = -num;
+        rounds = 6 + 52 / num;
+        sum = rounds * DELTA;
+        y = _mm256_loadu_si256(w);
+        do {
+            e = (sum >> 2) & 3;
+            const __m256i s = _mm256_set1_epi32(static_cast<int>(sum));
+            for (p = num - 1; p > 0; p--) {
+                z = _mm256_loadu_si256(w + p - 1);
+                y = _mm256_sub_epi32(_mm256_loadu_si256(w + p), mx_avx2(y, z, s, key[(p & 3) ^ e]));
+                _mm256_storeu_si256(w + p, y);
+            }
+            z = _mm256_loadu_si256(w + num - 1);
+            y = _mm256_sub_epi32(_mm256_loadu_si256(w), mx_avx2(y, z, s, key[(p & 3) ^ e]));
+            _mm256_storeu_si256(w, y);
+            sum -= DELTA;
+        } while (--rounds);
+    }
+}
+
+// runs btea on data[0, lanes) through an interleaved copy
+template <size_t lanes>
+void btea_lanes(void (*kernel)(uint32_t*, int32_t, const uint32_t*), std::vector<uint32_t>& v,
+    uint32_t* const* data, int32_t num, const uint32_t* const* keys) noexcept
+{
+    const size_t words = static_cast<size_t>(num > 0 ? num : -num);
+    uint32_t k[4 * lanes];
+    for (size_t l = 0; l < lanes; ++l) {
+        for (size_t p = 0; p < words; ++p)
+            v[p * lanes + l] = data[l][p];
+        for (size_t j = 0; j < 4; ++j)
+            k[j * lanes + l] = keys[l][j];
+    }
+    kernel(v.data(), num, k);
+    for (size_t l = 0; l < lanes; ++l) {
+        for (size_t p = 0; p < words; ++p)
+            data[l][p] = v[p * lanes + l];
+    }
+}
+
+} // namespace
+
+#endif
+
+void btea_batch(uint32_t* const* data, size_t count, int32_t num, const uint32_t* const* keys)
+{
+    size_t i = 0;
+#ifdef KLIB_X64
+    if ((num > 1 || num < -1) && count >= 4) {
+        static const bool has_avx2 = get_cpu_features().avx2;
+        std::vector<uint32_t> v(static_cast<size_t>(num > 0 ? num : -num) * 8);
+        if (has_avx2) {
+            for (; i + 8 <= count; i += 8)
+                btea_lanes<8>(btea_avx2, v, data + i, num, keys + i);
+        }
+        for (; i + 4 <= count; i += 4)
+            btea_lanes<4>(btea_sse2, v, data + i, num, keys + i);
+    }
+#endif
+    for (; i < count; ++i)
+        btea(data[i], num, keys[i]);
+}
+
+btea_ctr::btea_ctr(const uint32_t key[4], uint64_t nonce) noexcept
+    : _nonce(nonce)
+{
+    std::memcpy(_key, key, sizeof(_key));
+}
+
+void btea_ctr::crypt(void* data, size_t size, uint64_t offset) const
+{
+    // keystream blocks are generated in groups through btea_batch
+    const size_t block_size = 16;
+    const size_t group = 32;
+    uint32_t blocks[group][4];
+    uint32_t* ptrs[group];
+    const uint32_t* keys[group];
+    for (size_t i = 0; i < group; ++i) {
+        ptrs[i] = blocks[i];
+        keys[i] = _key;
+    }
+
+    uint8_t* p = static_cast<uint8_t*>(data);
+    uint64_t counter = offset / block_size;
+    size_t skip = static_cast<size_t>(offset % block_size);
+    while (size > 0) {
+        const size_t count = std::min(group, (skip + size + block_size - 1) / block_size);
+        for (size_t i = 0; i < count; ++i, ++counter) {
+            blocks[i][0] = static_cast<uint32_t>(_nonce);
+            blocks[i][1] = static_cast<uint32_t>(_nonce >> 32);
+            blocks[i][2] = static_cast<uint32_t>(counter);
+            blocks[i][3] = static_cast<uint32_t>(counter >> 32);
+        }
+        btea_batch(ptrs, count, 4, keys);
+
+        const uint8_t* stream = reinterpret_cast<const uint8_t*>(blocks) + skip;
+        const size_t n = std::min(size, count * block_size - skip);
+        for (size_t i = 0; i < n; ++i)
+            p[i] ^= stream[i];
+        p += n;
+        size -= n;
+        skip = 0;
+    }
+}
+
+namespace {
+
+inline uint32_t load_word(const uint8_t* p) noexcept
+{
+    uint32_t w;
+    std::memcpy(&w, p, 4);
+    return w;
+}
+
+// one encoding step on the word at w, y is its next word. the written
+// word is fed to the raw crc32 register when Crc is set.
+template <bool Crc>
+inline void encrypt_word(uint8_t* w, uint32_t y, uint32_t& z, uint32_t sum, uint32_t p, uint32_t e,
+    const uint32_t key[4], uint32_t& crc) noexcept
+{
+    z = load_word(w) + btea_mx(y, z, sum, p, e, key);
+    std::memcpy(w, &z, 4);
+    if (Crc) {
+        const auto& t = crc32_engine::table().slice;
+        const uint32_t c = crc ^ z;
+        crc = t[3][c & 0xff] ^ t[2][(c >> 8) & 0xff] ^ t[1][(c >> 16) & 0xff] ^ t[0][c >> 24];
+    }
+}
+
+// one encoding round over n words that need not be aligned
+template <bool Crc>
+inline uint32_t encrypt_round(uint8_t* data, uint32_t n, uint32_t& z, uint32_t sum, const uint32_t key[4],
+    uint32_t crc) noexcept
+{
+    const uint32_t e = (sum >> 2) & 3;
+    uint32_t p = 0;
+    for (; p + 1 < n; ++p)
+        encrypt_word<Crc>(data + p * 4, load_word(data + p * 4 + 4), z, sum, p, e, key, crc);
+    encrypt_word<Crc>(data + p * 4, load_word(data), z, sum, p, e, key, crc);
+    return crc;
+}
+
+// btea on words that need not be aligned, num as in btea
+void btea_unaligned(uint8_t* data, int32_t num, const uint32_t key[4]) noexcept
+{
+    if (num > 1) {
+        const uint32_t n = static_cast<uint32_t>(num);
+        uint32_t sum = 0;
+        uint32_t z = load_word(data + (n - 1) * 4);
+        for (uint32_t rounds = 6 + 52 / n; rounds > 0; --rounds)
+            encrypt_round<false>(data, n, z, sum += DELTA, key, 0);
+    } else if (num < -1) {
+        const uint32_t n = static_cast<uint32_t>(-num);
+        const uint32_t rounds = 6 + 52 / n;
+        uint32_t sum = rounds * DELTA;
+        uint32_t y = load_word(data);
+        for (uint32_t i = 0; i < rounds; ++i, sum -= DELTA) {
+            const uint32_t e = (sum >> 2) & 3;
+            for (uint32_t p = n; p-- > 0;) {
+                uint8_t* w = data + p * 4;
+                const uint32_t z = load_word(0 == p ? data + (n - 1) * 4 : w - 4);
+                y = load_word(w) - btea_mx(y, z, sum, p, e, key);
+                std::memcpy(w, &y, 4);
+            }
+        }
+    }
+}
+
+// btea encoding of n words that also returns the raw crc32 register over
+// the cipher text. the last round feeds every word to the crc as it is
+// written, so the cipher text is not read a second time.
+uint32_t btea_encrypt_crc32_table(uint8_t* data, uint32_t n, const uint32_t key[4], uint32_t crc) noexcept
+{
+    uint32_t sum = 0;
+    uint32_t z = load_word(data + (n - 1) * 4);
+    for (uint32_t rounds = 6 + 52 / n; rounds > 1; --rounds)
+        encrypt_round<false>(data, n, z, sum += DELTA, key, 0);
+    return encrypt_round<true>(data, n, z, sum + DELTA, key, crc);
+}
+
+#ifdef KLIB_X64
+
+// as btea_encrypt_crc32_table, but the last round folds every 16 written
+// bytes into a carry-less multiplication accumulator, which is much
+// cheaper than the table lookups. n >= 4.
+KLIB_TARGET("sse4.1,pclmul")
+uint32_t btea_encrypt_crc32_clmul(uint8_t* data, uint32_t n, const uint32_t key[4], uint32_t crc) noexcept
+{
+    uint32_t sum = 0;
+    uint32_t z = load_word(data + (n - 1) * 4);
+    for (uint32_t rounds = 6 + 52 / n; rounds > 1; --rounds)
+        encrypt_round<false>(data, n, z, sum += DELTA, key, 0);
+
+    sum += DELTA;
+    const uint32_t e = (sum >> 2) & 3;
+    const __m128i k3k4 = crc32_k3k4();
+    __m128i x = _mm_cvtsi32_si128(static_cast<int>(crc));
+    uint32_t p = 0;
+    for (; p + 4 < n; p += 4) {
+        uint8_t* w = data + p * 4;
+        encrypt_word<false>(w, load_word(w + 4), z, sum, p, e, key, crc);
+        encrypt_word<false>(w + 4, load_word(w + 8), z, sum, p + 1, e, key, crc);
+        encrypt_word<false>(w + 8, load_word(w + 12), z, sum, p + 2, e, key, crc);
+        encrypt_word<false>(w + 12, load_word(w + 16), z, sum, p + 3, e, key, crc);
+        x = 0 == p ? _mm_xor_si128(x, _mm_loadu_si128(reinterpret_cast<const __m128i*>(w)))
+                   : crc32_clmul_fold(x, k3k4, w);
+    }
+
+    // the last 1 to 4 words, the very last one wraps around to data[0]
+    crc = crc32_clmul_reduce(x);
+    for (; p + 1 < n; ++p)
+        encrypt_word<true>(data + p * 4, load_word(data + p * 4 + 4), z, sum, p, e, key, crc);
+    encrypt_word<true>(data + p * 4, load_word(data), z, sum, p, e, key, crc);
+    return crc;
+}
+
+#endif
+
+uint32_t btea_encrypt_crc32(uint8_t* data, uint32_t n, const uint32_t key[4], uint32_t crc) noexcept
+{
+#ifdef KLIB_X64
+    static const bool has_clmul = get_cpu_features().pclmul && get_cpu_features().sse41;
+    if (has_clmul && n > 4)
+        return btea_encrypt_crc32_clmul(data, n, key, crc);
+#endif
+    return btea_encrypt_crc32_table(data, n, key, crc);
+}
+
+void btea_bytes(uint8_t* data, int32_t num, const uint32_t key[4]) noexcept
+{
+    if (0 == reinterpret_cast<uintptr_t>(data) % alignof(uint32_t))
+        btea(reinterpret_cast<uint32_t*>(data), num, key);
+    else
+        btea_unaligned(data, num, key);
+}
+
+size_t btea_pad(uint8_t* p, size_t size, size_t capacity) noexcept
+{
+    const size_t padded = btea_padded_size(size);
+    if (capacity < padded || padded / 4 > INT32_MAX)
+        return 0;
+    p[size] = 0x80;
+    std::memset(p + size + 1, 0, padded - size - 1);
+    return padded;
+}
+
+} // namespace
+
+size_t btea_padded_size(size_t size) noexcept
+{
+    return std::max<size_t>(8, (size + 4) & ~static_cast<size_t>(3));
+}
+
+size_t btea_encrypt_bytes(void* data, size_t size, size_t capacity, const uint32_t key[4])
+{
+    uint8_t* p = static_cast<uint8_t*>(data);
+    const size_t padded = btea_pad(p, size, capacity);
+    if (0 != padded)
+        btea_bytes(p, static_cast<int32_t>(padded / 4), key);
+    return padded;
+}
+
+bool btea_decrypt_bytes(void* data, size_t size, const uint32_t key[4], size_t& plain_size)
+{
+    if (size < 8 || 0 != size % 4 || size / 4 > INT32_MAX)
+        return false;
+
+    uint8_t* p = static_cast<uint8_t*>(data);
+    btea_bytes(p, -static_cast<int32_t>(size / 4), key);
+
+    // the 0x80 marker is followed by zeros only and sits in the last word,
+    // or in the second to last for texts padded up to the 8 byte minimum
+    size_t n = size;
+    while (n > size - 8 && 0 == p[n - 1])
+        --n;
+    if (n == size - 8 || 0x80 != p[n - 1])
+        return false;
+    plain_size = n - 1;
+    return true;
+}
+
+size_t btea_sealed_size(size_t size) noexcept
+{
+    return btea_padded_size(size) + 4;
+}
+
+size_t btea_seal(void* data, size_t size, size_t capacity, const uint32_t key[4])
+{
+    uint8_t* p = static_cast<uint8_t*>(data);
+    const size_t padded = capacity < 4 ? 0 : btea_pad(p, size, capacity - 4);
+    if (0 == padded)
+        return 0;
+
+    const uint32_t crc = btea_encrypt_crc32(p, static_cast<uint32_t>(padded / 4), key, crc32_engine::init)
+        ^ crc32_engine::xorout;
+    for (size_t i = 0; i < 4; ++i)
+        p[padded + i] = static_cast<uint8_t>(crc >> (8 * i));
+    return padded + 4;
+}
+
+bool btea_open(void* data, size_t size, const uint32_t key[4], size_t& plain_size)
+{
+    if (size < 12)
+        return false;
+
+    uint8_t* p = static_cast<uint8_t*>(data);
+    size -= 4;
+    uint32_t crc = 0;
+    for (size_t i = 0; i < 4; ++i)
+        crc |= static_cast<uint32_t>(p[size + i]) << (8 * i);
+    return crc == calc_crc32(p, size) && btea_decrypt_bytes(p, size, key, plain_size);
+}
+
 } // namespace klib
@@ -0,0 +1,100 @@
+#include "../include/kbteachunked.h"
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+namespace {
+
+const uint32_t chunked_magic = 0x4354424b; // "KBTC"
+const size_t max_chunk_words = 1 << 26;
+
+void store_le(uint8_t* p, uint64_t v, size_t size) noexcept
+{
+    for (size_t i = 0; i < size; ++i)
+        p[i] = static_cast<uint8_t>(v >> (8 * i));
+}
+
+uint64_t load_le(const uint8_t* p, size_t size) noexcept
+{
+    uint64_t v = 0;
+    for (size_t i = 0; i < size; ++i)
+        v |= static_cast<uint64_t>(p[i]) << (8 * i);
+    return v;
+}
+
+// words of the last, possibly partial, chunk
+size_t tail_words(size_t size, size_t chunk_words) noexcept
+{
+    const size_t tail = size % (chunk_words * 4);
+    return 0 == tail ? 0 : std::max<size_t>(2, (tail + 3) / 4);
+}
+
+// runs btea on every chunk of src and writes the results to dst. the
+// chunks go through a word buffer per range, so neither side needs to
+// be aligned.
+void crypt_chunks(const uint8_t* src, uint8_t* dst, size_t size, size_t chunk_words,
+    bool encrypt, const uint32_t key[4], klib::worker_pool& pool)
+{
+    const size_t chunk_size = chunk_words * 4;
+    const size_t chunks = (size + chunk_size - 1) / chunk_size;
+    pool.parallel_for(chunks, [=](size_t begin, size_t end) {
+        std::vector<uint32_t> words(chunk_words);
+        for (size_t i = begin; i < end; ++i) {
+            const size_t offset = i * chunk_size;
+            const size_t n = std::min(chunk_size, size - offset);
+            const size_t num = n == chunk_size ? chunk_words : std::max<size_t>(2, (n + 3) / 4);
+            words[num - 1] = 0;
+            words[num - 2] = 0;
+            std::memcpy(words.data(), src + offset, encrypt ? n : num * 4);
+            klib::btea(words.data(), encrypt ? static_cast<int32_t>(num) : -static_cast<int32_t>(num), key);
+            std::memcpy(dst + offset, words.data(), encrypt ? num * 4 : n);
+        }
+    });
+}
+
+} // namespace
+
+namespace klib {
+
+size_t btea_chunked_size(size_t size, size_t chunk_words) noexcept
+{
+    const size_t chunk_size = chunk_words * 4;
+    return btea_chunked_header_size + size / chunk_size * chunk_size + tail_words(size, chunk_words) * 4;
+}
+
+void btea_encrypt_chunked(const void* data, size_t size, const uint32_t key[4],
+    memstream& out, worker_pool& pool, size_t chunk_words)
+{
+    chunk_words = std::min(std::max<size_t>(chunk_words, 2), max_chunk_words);
+    const size_t total = btea_chunked_size(size, chunk_words);
+    out.ensure_write(total);
+
+    uint8_t* p = out.write_ptr();
+    store_le(p, chunked_magic, 4);
+    store_le(p + 4, chunk_words, 4);
+    store_le(p + 8, size, 8);
+    crypt_chunks(static_cast<const uint8_t*>(data), p + btea_chunked_header_size, size, chunk_words, true, key, pool);
+    out.add_write(total);
+}
+
+bool btea_decrypt_chunked(const void* data, size_t size, const uint32_t key[4],
+    memstream& out, worker_pool& pool)
+{
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    if (size < btea_chunked_header_size || chunked_magic != load_le(p, 4))
+        return false;
+    const size_t chunk_words = static_cast<size_t>(load_le(p + 4, 4));
+    const uint64_t plain_size = load_le(p + 8, 8);
+    if (chunk_words < 2 || chunk_words > max_chunk_words || plain_size > size)
+        return false;
+    if (btea_chunked_size(static_cast<size_t>(plain_size), chunk_words) != size)
+        return false;
+
+    const size_t n = static_cast<size_t>(plain_size);
+    out.ensure_write(n);
+    crypt_chunks(p + btea_chunked_header_size, out.write_ptr(), n, chunk_words, false, key, pool);
+    out.add_write(n);
+    return true;
+}
+
+} // namespace klib
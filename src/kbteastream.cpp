@@ -0,0 +1,98 @@
+#include "../include/kbteastream.h"
+#include <algorithm>
+
+namespace klib {
+
+btea_wstream::btea_wstream(wstream& stream, const uint32_t key[4], size_t chunk_words)
+    : _stream(stream)
+    , _chunk(chunk_words > 1 ? chunk_words : 2)
+{
+    std::memcpy(_key, key, sizeof(_key));
+}
+
+bool btea_wstream::write(const void* data, size_t size)
+{
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    const size_t chunk_size = _chunk.size() * sizeof(uint32_t);
+    while (size > 0) {
+        const size_t n = std::min(size, chunk_size - _used);
+        std::memcpy(reinterpret_cast<uint8_t*>(_chunk.data()) + _used, p, n);
+        _used += n;
+        p += n;
+        size -= n;
+        if (_used == chunk_size && !write_chunk())
+            return false;
+    }
+    return true;
+}
+
+bool btea_wstream::finish()
+{
+    uint8_t* bytes = reinterpret_cast<uint8_t*>(_chunk.data());
+    const size_t chunk_size = _chunk.size() * sizeof(uint32_t);
+    bytes[_used] = 0x80;
+    std::fill(bytes + _used + 1, bytes + chunk_size, 0);
+    return write_chunk();
+}
+
+bool btea_wstream::write_chunk()
+{
+    btea(_chunk.data(), static_cast<int32_t>(_chunk.size()), _key);
+    _used = 0;
+    return _stream.write(_chunk.data(), _chunk.size() * sizeof(uint32_t));
+}
+
+btea_rstream::btea_rstream(rstream& stream, const uint32_t key[4], size_t chunk_words)
+    : _stream(stream)
+    , _chunk(chunk_words > 1 ? chunk_words : 2)
+{
+    std::memcpy(_key, key, sizeof(_key));
+}
+
+bool btea_rstream::peek(void* data, size_t size)
+{
+    return fill(size) && _plain.peek(data, size);
+}
+
+bool btea_rstream::discard(size_t size)
+{
+    return fill(size) && _plain.discard(size);
+}
+
+bool btea_rstream::read(void* data, size_t size)
+{
+    return fill(size) && _plain.read(data, size);
+}
+
+bool btea_rstream::fill(size_t size)
+{
+    while (_plain.read_size() < size) {
+        if (_finished || !read_chunk())
+            return false;
+    }
+    return true;
+}
+
+bool btea_rstream::read_chunk()
+{
+    const size_t chunk_size = _chunk.size() * sizeof(uint32_t);
+    if (!_stream.read(_chunk.data(), chunk_size))
+        return false;
+    btea(_chunk.data(), -static_cast<int32_t>(_chunk.size()), _key);
+
+    size_t size = chunk_size;
+    uint8_t probe;
+    if (!_stream.peek(&probe, 1)) {
+        // last chunk, strip 0x80 00 .. 00
+        const uint8_t* bytes = reinterpret_cast<const uint8_t*>(_chunk.data());
+        while (size > 0 && 0 == bytes[size - 1])
+            --size;
+        if (0 == size || 0x80 != bytes[size - 1])
+            return false;
+        --size;
+        _finished = true;
+    }
+    return _plain.write(_chunk.data(), size);
+}
+
+} // namespace klib
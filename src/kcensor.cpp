@@ -1,92 +1,683 @@
 #include "../include/kcensor.h"
+#include "../include/kcensorfile.h"
+#include "../include/kcrc32.h"
+#include "../include/kstream.h"
+#include "../include/kworker.h"
+#include "kcensormatch.h"
+#include "kcpu.h"
+#include <algorithm>
+#include <cctype>
+#include <stdexcept>
+#include <thread>
 
 namespace {
 
-int utf8_width(const char* s) noexcept
+// messages per verdict store of the batch calls
+const size_t batch_block = 256;
+
+// the code point of the utf-8 character of width w at s, false if the
+// bytes are not a valid sequence
+bool utf8_decode(const char* s, size_t w, uint32_t& cp) noexcept
+{
+    const auto b = reinterpret_cast<const unsigned char*>(s);
+    if (1 == w) {
+        cp = b[0];
+        return b[0] < 0x80;
+    }
+    cp = b[0] & (0x7f >> w);
+    for (size_t i = 1; i < w; ++i) {
+        if (0x80 != (b[i] & 0xc0))
+            return false;
+        cp = (cp << 6) | (b[i] & 0x3f);
+    }
+    return true;
+}
+
+size_t utf8_encode(uint32_t cp, char* out) noexcept
 {
-    const unsigned char c = static_cast<unsigned char>(*s);
-    if (c >= 0 && c <= 127)
+    if (cp < 0x80) {
+        out[0] = static_cast<char>(cp);
         return 1;
-    else if ((c & 0xe0) == 0xc0)
+    }
+    if (cp < 0x800) {
+        out[0] = static_cast<char>(0xc0 | (cp >> 6));
+        out[1] = static_cast<char>(0x80 | (cp & 0x3f));
         return 2;
-    else if ((c & 0xf0) == 0xe0)
+    }
+    if (cp < 0x10000) {
+        out[0] = static_cast<char>(0xe0 | (cp >> 12));
+        out[1] = static_cast<char>(0x80 | ((cp >> 6) & 0x3f));
+        out[2] = static_cast<char>(0x80 | (cp & 0x3f));
         return 3;
-    else if ((c & 0xf8) == 0xf0)
-        return 4;
-    //else if ((c & 0xfc) == 0xf8)
-    //   return 5;
-    //else if ((c & 0xfe) == 0xfc)
-    //   return 6;
-    else
-        return 0;
+    }
+    out[0] = static_cast<char>(0xf0 | (cp >> 18));
+    out[1] = static_cast<char>(0x80 | ((cp >> 12) & 0x3f));
+    out[2] = static_cast<char>(0x80 | ((cp >> 6) & 0x3f));
+    out[3] = static_cast<char>(0x80 | (cp & 0x3f));
+    return 4;
+}
+
+// the character at a lattice position as the matcher sees it: the folded
+// code point, or the raw bytes when they are not valid utf-8
+struct folded_char {
+    size_t width; // bytes in the text
+    size_t size; // bytes in buf
+    char buf[4];
+    bool skipped;
+};
+
+folded_char fold_char(const char* s, size_t pos, size_t n, const klib::censor_fold& fold) noexcept
+{
+    folded_char c;
+    const size_t step = klib::utf8_step(s + pos);
+    c.width = std::min(step, n - pos);
+    uint32_t cp;
+    if (step != c.width || !utf8_decode(s + pos, c.width, cp)) {
+        c.size = c.width;
+        std::copy(s + pos, s + pos + c.width, c.buf);
+        c.skipped = false;
+        return c;
+    }
+    c.skipped = fold.skipped(cp);
+    c.size = utf8_encode(fold.fold(cp), c.buf);
+    return c;
+}
+
+inline unsigned lowest_bit(uint32_t v) noexcept
+{
+#if defined(_MSC_VER)
+    unsigned long i;
+    _BitScanForward(&i, v);
+    return static_cast<unsigned>(i);
+#else
+    return static_cast<unsigned>(__builtin_ctz(v));
+#endif
+}
+
+size_t skip_scalar(const klib::censor_prefilter& first, const char* s, size_t pos, size_t n) noexcept
+{
+    while (pos < n && !first.test(static_cast<unsigned char>(s[pos])))
+        ++pos;
+    return pos;
 }
 
+#ifdef KLIB_X64
+
+// the nibble tables give a superset of the first bytes ("shufti"), the
+// candidates are checked against the exact set
+KLIB_TARGET("ssse3")
+size_t skip_ssse3(const klib::censor_prefilter& first, const char* s, size_t pos, size_t n) noexcept
+{
+    const __m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(first.lo));
+    const __m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(first.hi));
+    const __m128i nibble = _mm_set1_epi8(0x0f);
+    for (; pos + 16 <= n; pos += 16) {
+        const __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + pos));
+        const __m128i l = _mm_shuffle_epi8(lo, _mm_and_si128(x, nibble));
+        const __m128i h = _mm_shuffle_epi8(hi, _mm_and_si128(_mm_srli_epi16(x, 4), nibble));
+        const __m128i none = _mm_cmpeq_epi8(_mm_and_si128(l, h), _mm_setzero_si128());
+        for (uint32_t m = ~static_cast<uint32_t>(_mm_movemask_epi8(none)) & 0xffff; 0 != m; m &= m - 1) {
+            const size_t i = pos + lowest_bit(m);
+            if (first.test(static_cast<unsigned char>(s[i])))
+                return i;
+        }
+    }
+    return skip_scalar(first, s, pos, n);
+}
+
+KLIB_TARGET("avx2")
+size_t skip_avx2(const klib::censor_prefilter& first, const char* s, size_t pos, size_t n) noexcept
+{
+    const __m256i lo = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(first.lo)));
+    const __m256i hi = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(first.hi)));
+    const __m256i nibble = _mm256_set1_epi8(0x0f);
+    for (; pos + 32 <= n; pos += 32) {
+        const __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s + pos));
+        const __m256i l = _mm256_shuffle_epi8(lo, _mm256_and_si256(x, nibble));
+        const __m256i h = _mm256_shuffle_epi8(hi, _mm256_and_si256(_mm256_srli_epi16(x, 4), nibble));
+        const __m256i none = _mm256_cmpeq_epi8(_mm256_and_si256(l, h), _mm256_setzero_si256());
+        for (uint32_t m = ~static_cast<uint32_t>(_mm256_movemask_epi8(none)); 0 != m; m &= m - 1) {
+            const size_t i = pos + lowest_bit(m);
+            if (first.test(static_cast<unsigned char>(s[i])))
+                return i;
+        }
+    }
+    return skip_ssse3(first, s, pos, n);
+}
+
+#endif
+
 } // namespace
 
 namespace klib {
 
-void censor::add_word(const std::string& word)
+size_t censor_skip(const censor_prefilter& first, const char* s, size_t pos, size_t n) noexcept
+{
+#ifdef KLIB_X64
+    static const bool has_avx2 = get_cpu_features().avx2;
+    static const bool has_ssse3 = get_cpu_features().ssse3;
+    if (has_avx2)
+        return skip_avx2(first, s, pos, n);
+    if (has_ssse3)
+        return skip_ssse3(first, s, pos, n);
+#endif
+    return skip_scalar(first, s, pos, n);
+}
+
+void censor_fold::map(uint32_t from, uint32_t to)
+{
+    const auto it = std::lower_bound(_map.begin(), _map.end(), std::make_pair(from, uint32_t(0)));
+    if (it != _map.end() && it->first == from)
+        it->second = to;
+    else
+        _map.insert(it, std::make_pair(from, to));
+}
+
+void censor_fold::skip(uint32_t cp)
+{
+    const auto it = std::lower_bound(_skip.begin(), _skip.end(), cp);
+    if (it == _skip.end() || *it != cp)
+        _skip.insert(it, cp);
+}
+
+uint32_t censor_fold::fold(uint32_t cp) const noexcept
 {
-    auto cur = _root;
+    if (half_width) {
+        if (cp >= 0xff01 && cp <= 0xff5e)
+            cp -= 0xff01 - 0x21;
+        else if (0x3000 == cp)
+            cp = ' ';
+    }
+    const auto it = std::lower_bound(_map.begin(), _map.end(), std::make_pair(cp, uint32_t(0)));
+    if (it != _map.end() && it->first == cp)
+        cp = it->second;
+    if (lower_case && cp >= 'A' && cp <= 'Z')
+        cp += 'a' - 'A';
+    return cp;
+}
+
+bool censor_fold::skipped(uint32_t cp) const noexcept
+{
+    const auto it = std::lower_bound(_map.begin(), _map.end(), std::make_pair(cp, uint32_t(0)));
+    if (it != _map.end() && it->first == cp)
+        return false;
+    if (std::binary_search(_skip.begin(), _skip.end(), cp))
+        return true;
+    if (half_width && cp >= 0xff01 && cp <= 0xff5e)
+        cp -= 0xff01 - 0x21;
+    if (0 != (skip_classes & skip_space) && (' ' == cp || (cp >= '\t' && cp <= '\r') || 0x3000 == cp))
+        return true;
+    if (0 != (skip_classes & skip_punct) && cp < 0x80 && std::ispunct(static_cast<int>(cp)))
+        return true;
+    return false;
+}
+
+std::string censor_fold::apply(const std::string& word) const
+{
+    std::string ret;
+    ret.reserve(word.size());
+    for (size_t i = 0; i < word.size();) {
+        const folded_char c = fold_char(word.data(), i, word.size(), *this);
+        if (!c.skipped)
+            ret.append(c.buf, c.size);
+        i += c.width;
+    }
+    return ret;
+}
+
+// the node arena as seen by search_trie
+struct censor::node_trie {
+    using node_type = uint32_t;
+
+    const node* nodes;
+    const uint32_t* links;
+    size_t longest;
+    const censor_prefilter* first;
+
+    node_type root() const noexcept
+    {
+        return 0;
+    }
+    size_t max_depth() const noexcept
+    {
+        return longest;
+    }
+    const censor_prefilter& first_bytes() const noexcept
+    {
+        return *first;
+    }
+    node_type child(node_type n, unsigned char c) const noexcept
+    {
+        return censor::child(nodes, links, n, c);
+    }
+    node_type fail(node_type n) const noexcept
+    {
+        return nodes[n].fail;
+    }
+    node_type dict(node_type n) const noexcept
+    {
+        return nodes[n].dict;
+    }
+    size_t depth(node_type n) const noexcept
+    {
+        return nodes[n].depth;
+    }
+    bool isword(node_type n) const noexcept
+    {
+        return nodes[n].isword && 0 != n;
+    }
+};
+
+uint32_t censor::child(const node* nodes, const uint32_t* links, uint32_t n, unsigned char c) noexcept
+{
+    const node& p = nodes[n];
+    if (0 == (p.bits[c >> 6] & (uint64_t(1) << (c & 63))))
+        return 0;
+    return links[p.first + censor_rank(p.bits, c)];
+}
+
+uint32_t censor::add_child(uint32_t n, unsigned char c)
+{
+    const uint32_t found = child(n, c);
+    if (0 != found)
+        return found;
+
+    // both the node and a moved child list must stay within 32-bit indices
+    size_t count = 0;
+    for (const auto b : _nodes[n].bits)
+        count += static_cast<size_t>(popcount64(b));
+    const size_t room = count < _nodes[n].room ? 0 : 0 == count ? 1 : count * 2;
+    if (_nodes.size() >= UINT32_MAX || _links.size() + room > UINT32_MAX)
+        throw std::length_error("censor: too many trie nodes");
+
+    const uint32_t ret = static_cast<uint32_t>(_nodes.size());
+    _nodes.emplace_back();
+    _nodes[ret].depth = _nodes[n].depth + 1;
+
+    node& p = _nodes[n];
+    if (0 != room) {
+        const size_t first = _links.size();
+        _links.resize(first + room);
+        std::copy(_links.begin() + p.first, _links.begin() + p.first + count, _links.begin() + first);
+        p.first = static_cast<uint32_t>(first);
+        p.room = static_cast<uint16_t>(room);
+    }
+    const auto pos = _links.begin() + p.first + censor_rank(p.bits, c);
+    std::copy_backward(pos, _links.begin() + p.first + count, _links.begin() + p.first + count + 1);
+    *pos = ret;
+    p.bits[c >> 6] |= uint64_t(1) << (c & 63);
+    return ret;
+}
+
+uint32_t censor::add_word(const std::string& word)
+{
+    if (!word.empty())
+        _first.add(static_cast<unsigned char>(word[0]));
+    uint32_t cur = 0;
     for (const auto w : word) {
-        const auto c = static_cast<unsigned char>(w);
-        auto& next = cur->nodes[c];
-        if (nullptr == next)
-            next = new node();
-        cur = next;
+        cur = add_child(cur, static_cast<unsigned char>(w));
     }
-    cur->isword = true;
+    node& n = _nodes[cur];
+    if (!n.isword) {
+        n.isword = true;
+        n.word = _words++;
+    }
+    _depth = std::max(_depth, word.size());
+    _compiled = false;
+    return n.word;
 }
 
-bool censor::has_word(const std::string& sentence) const noexcept
+void censor::compile()
 {
-    for (size_t i = 0, N = sentence.size(); i < N;) {
-        if (is_word(sentence, i))
-            return true;
-        const int len = utf8_width(&sentence[i]);
-        if (len <= 0)
-            ++i;
-        else
-            i += static_cast<size_t>(len);
+    // breadth first, so the suffix links of shallower nodes are final
+    std::vector<uint32_t> queue(1, 0);
+    queue.reserve(_nodes.size());
+    _nodes[0].fail = 0;
+    _nodes[0].dict = 0;
+    for (size_t i = 0; i < queue.size(); ++i) {
+        const uint32_t parent = queue[i];
+        for (unsigned c = 0; c < 0x100; ++c) {
+            const uint32_t n = child(parent, static_cast<unsigned char>(c));
+            if (0 == n)
+                continue;
+
+            // the children of the root fail to the root
+            uint32_t fail = 0;
+            if (0 != parent) {
+                for (fail = _nodes[parent].fail;; fail = _nodes[fail].fail) {
+                    const uint32_t next = child(fail, static_cast<unsigned char>(c));
+                    if (0 != next || 0 == fail) {
+                        fail = next;
+                        break;
+                    }
+                }
+            }
+            node& p = _nodes[n];
+            p.fail = fail;
+            p.dict = _nodes[fail].isword && 0 != fail ? fail : _nodes[fail].dict;
+            queue.push_back(n);
+        }
     }
-    return false;
+    _compiled = true;
 }
 
-bool censor::filter_word(std::string& sentence, char replace) const noexcept
+// the trie scan: the shortest word at each lattice position, or the
+// automaton once compiled
+template <typename Emit>
+bool censor::scan(const char* s, size_t n, bool first, Emit&& emit) const noexcept
 {
+    if (_compiled)
+        return search_trie(node_trie { _nodes.data(), _links.data(), _depth, &_first }, s, n, first, emit);
+
     bool ret = false;
-    size_t end = 0;
-    for (size_t i = 0, N = sentence.size(); i < N;) {
-        if (is_word(sentence, i, &end)) {
-            std::fill(&sentence[i], &sentence[end], replace);
-            i = end;
+    for (size_t i = 0; i < n;) {
+        if (!_first.test(static_cast<unsigned char>(s[i]))) {
+            const size_t pos = censor_skip(_first, s, i, n);
+            if (pos >= n)
+                break;
+            i = utf8_resync(s, i, i, pos);
+            continue;
+        }
+
+        uint32_t cur = 0;
+        for (size_t pos = i; pos < n; ++pos) {
+            cur = child(cur, static_cast<unsigned char>(s[pos]));
+            if (0 == cur || _nodes[cur].isword)
+                break;
+        }
+        if (0 != cur && _nodes[cur].isword) {
+            if (first)
+                return true;
             ret = true;
+            const size_t depth = _nodes[cur].depth;
+            if (!emit(i, i + depth, cur))
+                break;
+            i += depth;
             continue;
         }
-        const int len = utf8_width(&sentence[i]);
-        if (len <= 0)
-            ++i;
-        else
-            i += static_cast<size_t>(len);
+        i += utf8_step(s + i);
     }
     return ret;
 }
 
-bool censor::is_word(const std::string& word, size_t pos, size_t* end) const noexcept
+// the trie scan on folded characters: from each lattice position that is
+// not skipped, the trie is stepped through the folded bytes of the
+// following characters, passing over skipped ones, up to the first word
+template <typename Emit>
+bool censor::scan_folded(const char* s, size_t n, const censor_fold& fold, bool first, Emit&& emit) const noexcept
 {
-    auto cur = _root;
-    for (size_t N = word.size(); pos < N; ++pos) {
-        const auto c = static_cast<unsigned char>(word[pos]);
-        cur = cur->nodes[c];
-        if (nullptr == cur)
-            return false;
-        if (cur->isword) {
-            if (nullptr != end)
-                *end = pos + 1;
-            return true;
+    bool ret = false;
+    for (size_t i = 0; i < n;) {
+        const folded_char head = fold_char(s, i, n, fold);
+        uint32_t word = 0;
+        size_t end = i;
+        if (!head.skipped) {
+            uint32_t cur = 0;
+            folded_char c = head;
+            for (size_t pos = i; 0 == word;) {
+                if (pos != i && c.skipped) {
+                    pos += c.width;
+                } else {
+                    for (size_t k = 0; k < c.size; ++k) {
+                        cur = child(cur, static_cast<unsigned char>(c.buf[k]));
+                        if (0 == cur)
+                            break;
+                        if (_nodes[cur].isword) {
+                            word = cur;
+                            // a word may end inside a character as in scan,
+                            // unless folding changed its length
+                            end = c.size == c.width ? pos + k + 1 : pos + c.width;
+                            break;
+                        }
+                    }
+                    if (0 == cur)
+                        break;
+                    pos += c.width;
+                }
+                if (pos >= n)
+                    break;
+                c = fold_char(s, pos, n, fold);
+            }
         }
+
+        if (0 != word) {
+            if (first)
+                return true;
+            ret = true;
+            if (!emit(i, end, word))
+                break;
+            i = end;
+            continue;
+        }
+        i += head.width;
     }
-    return false;
+    return ret;
+}
+
+bool censor::has_word(const std::string& sentence) const noexcept
+{
+    return scan(sentence.data(), sentence.size(), true, [](size_t, size_t, uint32_t) { return false; });
+}
+
+bool censor::filter_word(std::string& sentence, char replace) const noexcept
+{
+    char* out = &sentence[0];
+    return scan(sentence.data(), sentence.size(), false, [out, replace](size_t begin, size_t end, uint32_t) {
+        std::fill(out + begin, out + end, replace);
+        return true;
+    });
+}
+
+void censor::has_word_batch(const std::string* messages, size_t count, bool* verdicts, worker_pool& pool) const
+{
+    pool.parallel_for(count, [=](size_t begin, size_t end) {
+        bool local[batch_block];
+        for (size_t i = begin; i < end; i += batch_block) {
+            const size_t n = std::min(batch_block, end - i);
+            for (size_t k = 0; k < n; ++k)
+                local[k] = has_word(messages[i + k]);
+            std::copy(local, local + n, verdicts + i);
+        }
+    });
+}
+
+void censor::filter_word_batch(std::string* messages, size_t count, bool* verdicts, worker_pool& pool,
+    char replace) const
+{
+    pool.parallel_for(count, [=](size_t begin, size_t end) {
+        bool local[batch_block];
+        for (size_t i = begin; i < end; i += batch_block) {
+            const size_t n = std::min(batch_block, end - i);
+            for (size_t k = 0; k < n; ++k)
+                local[k] = filter_word(messages[i + k], replace);
+            if (nullptr != verdicts)
+                std::copy(local, local + n, verdicts + i);
+        }
+    });
+}
+
+size_t censor::find_words(const char* text, size_t size, censor_span* spans, size_t capacity) const noexcept
+{
+    span_sink sink = { spans, capacity, nullptr, nullptr, 0 };
+    scan(text, size, false, [this, &sink](size_t begin, size_t end, uint32_t n) { return sink(begin, end, _nodes[n].word); });
+    return sink.count;
+}
+
+size_t censor::for_each_word(const char* text, size_t size, censor_callback fn, void* context) const noexcept
+{
+    span_sink sink = { nullptr, 0, fn, context, 0 };
+    scan(text, size, false, [this, &sink](size_t begin, size_t end, uint32_t n) { return sink(begin, end, _nodes[n].word); });
+    return sink.count;
+}
+
+bool censor::has_word(const std::string& sentence, const censor_fold& fold) const noexcept
+{
+    return scan_folded(
+        sentence.data(), sentence.size(), fold, true, [](size_t, size_t, uint32_t) { return false; });
+}
+
+bool censor::filter_word(std::string& sentence, const censor_fold& fold, char replace) const noexcept
+{
+    char* out = &sentence[0];
+    return scan_folded(
+        sentence.data(), sentence.size(), fold, false, [out, replace](size_t begin, size_t end, uint32_t) {
+            std::fill(out + begin, out + end, replace);
+            return true;
+        });
+}
+
+size_t censor::find_words(const char* text, size_t size, const censor_fold& fold, censor_span* spans,
+    size_t capacity) const noexcept
+{
+    span_sink sink = { spans, capacity, nullptr, nullptr, 0 };
+    scan_folded(
+        text, size, fold, false, [this, &sink](size_t begin, size_t end, uint32_t n) { return sink(begin, end, _nodes[n].word); });
+    return sink.count;
+}
+
+size_t censor_matcher::feed(const char* data, size_t size, censor_callback fn, void* context)
+{
+    _pending.append(data, size);
+    // a match is final once every position before it has seen the
+    // longest word, and so are the positions where nothing matched
+    const size_t n = _pending.size();
+    return scan(n + 1 > _censor->_depth ? n + 1 - _censor->_depth : 0, fn, context);
+}
+
+size_t censor_matcher::finish(censor_callback fn, void* context)
+{
+    size_t count = 0;
+    do
+        count += scan(_pending.size(), fn, context);
+    while (!_pending.empty());
+    return count;
+}
+
+void censor_matcher::reset() noexcept
+{
+    _pending.clear();
+    _base = 0;
+}
+
+// passes the matches starting at or before limit and drops the bytes up
+// to the last lattice position at or before limit not inside a match
+size_t censor_matcher::scan(size_t limit, censor_callback fn, void* context)
+{
+    const char* s = _pending.data();
+    const size_t n = _pending.size();
+    size_t count = 0;
+    size_t resume = 0;
+    bool stopped = false;
+    _censor->scan(s, n, false, [&](size_t begin, size_t end, uint32_t word) {
+        if (begin > limit)
+            return false;
+        ++count;
+        resume = end;
+        const censor_span span = { _base + begin, end - begin, _censor->_nodes[word].word };
+        stopped = !fn(context, span);
+        return !stopped;
+    });
+    if (!stopped) {
+        while (resume < n && resume + utf8_step(s + resume) <= limit)
+            resume += utf8_step(s + resume);
+        if (limit >= n)
+            resume = n;
+    }
+    _pending.erase(0, resume);
+    _base += resume;
+    return count;
+}
+
+size_t censor::memory_usage() const noexcept
+{
+    return _nodes.capacity() * sizeof(node) + _links.capacity() * sizeof(uint32_t);
+}
+
+bool censor::save(wstream& w) const
+{
+    if (!_compiled || _nodes.size() > UINT32_MAX)
+        return false;
+
+    // breadth first, the children of a node are consecutive in byte order
+    std::vector<uint32_t> queue(1, 0);
+    std::vector<uint32_t> index(_nodes.size());
+    std::vector<censor_file_node> nodes;
+    queue.reserve(_nodes.size());
+    nodes.reserve(_nodes.size());
+    for (size_t i = 0; i < queue.size(); ++i) {
+        const node& n = _nodes[queue[i]];
+        size_t count = 0;
+        for (const auto b : n.bits)
+            count += static_cast<size_t>(popcount64(b));
+        censor_file_node f = {};
+        std::copy(std::begin(n.bits), std::end(n.bits), std::begin(f.bits));
+        f.first = static_cast<uint32_t>(0 == count ? 0 : queue.size());
+        f.depth = n.depth | (n.isword && 0 != i ? censor_file_word : 0);
+        f.word = n.word;
+        nodes.push_back(f);
+        index[queue[i]] = static_cast<uint32_t>(i);
+        queue.insert(queue.end(), _links.begin() + n.first, _links.begin() + n.first + count);
+    }
+    for (size_t i = 1; i < queue.size(); ++i) {
+        nodes[i].fail = index[_nodes[queue[i]].fail];
+        nodes[i].dict = index[_nodes[queue[i]].dict];
+    }
+
+    censor_file_header header = {};
+    header.magic = censor_file_magic;
+    header.version = censor_file_version;
+    header.nodes = static_cast<uint32_t>(nodes.size());
+    header.depth = static_cast<uint32_t>(_depth);
+    header.crc = calc_crc32(nodes.data(), nodes.size() * sizeof(censor_file_node));
+    header.size = sizeof(header) + nodes.size() * sizeof(censor_file_node);
+    return w.write(&header, sizeof(header)) && w.write(nodes.data(), nodes.size() * sizeof(censor_file_node));
+}
+
+censor_snapshot make_censor_snapshot(const std::vector<std::string>& words)
+{
+    std::shared_ptr<censor> c = std::make_shared<censor>();
+    for (const auto& w : words)
+        c->add_word(w);
+    c->compile();
+    return c;
+}
+
+censor_holder::censor_holder(censor_snapshot snapshot)
+    : _current(new censor_snapshot(std::move(snapshot)))
+{
+    _readers[0] = 0;
+    _readers[1] = 0;
+}
+
+censor_holder::~censor_holder()
+{
+    delete _current.load();
+}
+
+censor_snapshot censor_holder::load() const noexcept
+{
+    auto& readers = _readers[_parity.load() & 1];
+    ++readers;
+    censor_snapshot snapshot = *_current.load();
+    --readers;
+    return snapshot;
+}
+
+void censor_holder::store(censor_snapshot snapshot)
+{
+    auto next = new censor_snapshot(std::move(snapshot));
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto prev = _current.exchange(next);
+    // a reader of prev counted itself before the exchange, on either side
+    wait_readers(_parity++);
+    wait_readers(_parity++);
+    delete prev;
+}
+
+void censor_holder::wait_readers(unsigned parity) const noexcept
+{
+    while (0 != _readers[parity & 1].load())
+        std::this_thread::yield();
 }
 
 } // namespace klib
@@ -0,0 +1,209 @@
+#include "../include/kcensorfile.h"
+#include "../include/kcrc32.h"
+#include "kcensormatch.h"
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace klib {
+
+// the file nodes as seen by search_trie, index 0 is the root and never a
+// child or dict link, so it also stands for no node
+struct censor_view::flat_trie {
+    using node_type = uint32_t;
+
+    const censor_file_node* nodes;
+    size_t longest;
+    const censor_prefilter* first;
+
+    node_type root() const noexcept
+    {
+        return 0;
+    }
+    size_t max_depth() const noexcept
+    {
+        return longest;
+    }
+    const censor_prefilter& first_bytes() const noexcept
+    {
+        return *first;
+    }
+    node_type child(node_type n, unsigned char c) const noexcept
+    {
+        const auto& node = nodes[n];
+        if (0 == (node.bits[c >> 6] & (uint64_t(1) << (c & 63))))
+            return 0;
+        return node.first + static_cast<node_type>(censor_rank(node.bits, c));
+    }
+    node_type fail(node_type n) const noexcept
+    {
+        return nodes[n].fail;
+    }
+    node_type dict(node_type n) const noexcept
+    {
+        return nodes[n].dict;
+    }
+    size_t depth(node_type n) const noexcept
+    {
+        return nodes[n].depth & ~censor_file_word;
+    }
+    bool isword(node_type n) const noexcept
+    {
+        return 0 != (nodes[n].depth & censor_file_word);
+    }
+};
+
+bool censor_view::open(const void* data, size_t size, bool verify) noexcept
+{
+    _nodes = nullptr;
+    const auto header = static_cast<const censor_file_header*>(data);
+    if (nullptr == data || 0 != reinterpret_cast<uintptr_t>(data) % alignof(censor_file_node))
+        return false;
+    if (size < sizeof(censor_file_header) || censor_file_magic != header->magic
+        || censor_file_version != header->version || size != header->size || 0 == header->nodes
+        || (size - sizeof(censor_file_header)) / sizeof(censor_file_node) != header->nodes
+        || (size - sizeof(censor_file_header)) % sizeof(censor_file_node) != 0)
+        return false;
+
+    const auto nodes = reinterpret_cast<const censor_file_node*>(header + 1);
+    const size_t count = header->nodes;
+    if (verify) {
+        if (header->crc != calc_crc32(nodes, count * sizeof(censor_file_node)))
+            return false;
+        // the links must lead to shallower nodes and the children one level
+        // down, so the fail walks of the scan end at the root
+        auto depth = [nodes](size_t i) { return nodes[i].depth & ~censor_file_word; };
+        if (0 != depth(0))
+            return false;
+        for (size_t i = 0; i < count; ++i) {
+            const auto& n = nodes[i];
+            size_t children = 0;
+            for (auto b : n.bits)
+                children += static_cast<size_t>(popcount64(b));
+            if ((0 != children && (0 == n.first || n.first + children > count)) || n.fail >= count
+                || n.dict >= count || depth(i) > header->depth)
+                return false;
+            if (0 != i && (depth(n.fail) >= depth(i) || depth(n.dict) >= depth(i)))
+                return false;
+            for (size_t k = 0; k < children; ++k) {
+                if (depth(n.first + k) != depth(i) + 1)
+                    return false;
+            }
+        }
+    }
+
+    _nodes = nodes;
+    _count = count;
+    _depth = header->depth;
+    _first = censor_prefilter();
+    for (unsigned c = 0; c < 0x100; ++c) {
+        if (0 != (nodes[0].bits[c >> 6] & (uint64_t(1) << (c & 63))))
+            _first.add(static_cast<unsigned char>(c));
+    }
+    return true;
+}
+
+bool censor_view::has_word(const std::string& sentence) const noexcept
+{
+    return valid()
+        && search_trie(flat_trie { _nodes, _depth, &_first }, sentence.data(), sentence.size(), true,
+            [](size_t, size_t, uint32_t) { return false; });
+}
+
+bool censor_view::filter_word(std::string& sentence, char replace) const noexcept
+{
+    char* out = &sentence[0];
+    return valid()
+        && search_trie(flat_trie { _nodes, _depth, &_first }, sentence.data(), sentence.size(), false,
+            [out, replace](size_t begin, size_t end, uint32_t) {
+                std::fill(out + begin, out + end, replace);
+                return true;
+            });
+}
+
+size_t censor_view::find_words(const char* text, size_t size, censor_span* spans, size_t capacity) const noexcept
+{
+    span_sink sink = { spans, capacity, nullptr, nullptr, 0 };
+    if (valid()) {
+        search_trie(flat_trie { _nodes, _depth, &_first }, text, size, false,
+            [this, &sink](size_t begin, size_t end, uint32_t n) { return sink(begin, end, _nodes[n].word); });
+    }
+    return sink.count;
+}
+
+size_t censor_view::for_each_word(const char* text, size_t size, censor_callback fn, void* context) const noexcept
+{
+    span_sink sink = { nullptr, 0, fn, context, 0 };
+    if (valid()) {
+        search_trie(flat_trie { _nodes, _depth, &_first }, text, size, false,
+            [this, &sink](size_t begin, size_t end, uint32_t n) { return sink(begin, end, _nodes[n].word); });
+    }
+    return sink.count;
+}
+
+censor_file::~censor_file()
+{
+    close();
+}
+
+bool censor_file::open(const char* path, bool verify)
+{
+    close();
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (INVALID_HANDLE_VALUE == file)
+        return false;
+    LARGE_INTEGER size;
+    HANDLE mapping = nullptr;
+    if (GetFileSizeEx(file, &size) && size.QuadPart > 0)
+        mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    CloseHandle(file);
+    if (nullptr == mapping)
+        return false;
+    _data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping);
+    if (nullptr == _data)
+        return false;
+    _size = static_cast<size_t>(size.QuadPart);
+#else
+    const int fd = ::open(path, O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    void* data = MAP_FAILED;
+    if (0 == fstat(fd, &st) && st.st_size > 0)
+        data = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (MAP_FAILED == data)
+        return false;
+    _data = data;
+    _size = static_cast<size_t>(st.st_size);
+#endif
+
+    if (!_view.open(_data, _size, verify)) {
+        close();
+        return false;
+    }
+    return true;
+}
+
+void censor_file::close() noexcept
+{
+    if (nullptr == _data)
+        return;
+#ifdef _WIN32
+    UnmapViewOfFile(_data);
+#else
+    munmap(_data, _size);
+#endif
+    _data = nullptr;
+    _size = 0;
+    _view = censor_view();
+}
+
+} // namespace klib
@@ -0,0 +1,244 @@
+#pragma once
+#include "../include/kcensor.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace klib {
+
+inline int utf8_width(const char* s) noexcept
+{
+    const unsigned char c = static_cast<unsigned char>(*s);
+    if (c >= 0 && c <= 127)
+        return 1;
+    else if ((c & 0xe0) == 0xc0)
+        return 2;
+    else if ((c & 0xf0) == 0xe0)
+        return 3;
+    else if ((c & 0xf8) == 0xf0)
+        return 4;
+    //else if ((c & 0xfc) == 0xf8)
+    //   return 5;
+    //else if ((c & 0xfe) == 0xfc)
+    //   return 6;
+    else
+        return 0;
+}
+
+inline int popcount64(uint64_t v) noexcept
+{
+#if defined(_MSC_VER)
+    return static_cast<int>(__popcnt64(v));
+#else
+    return __builtin_popcountll(v);
+#endif
+}
+
+// rank of c among the bytes set in the 256-bit bitmap bits
+inline size_t censor_rank(const uint64_t* bits, unsigned char c) noexcept
+{
+    int r = popcount64(bits[c >> 6] & ((uint64_t(1) << (c & 63)) - 1));
+    for (int i = 0; i < (c >> 6); ++i)
+        r += popcount64(bits[i]);
+    return static_cast<size_t>(r);
+}
+
+inline size_t utf8_step(const char* s) noexcept
+{
+    const int len = utf8_width(s);
+    return len <= 0 ? 1 : static_cast<size_t>(len);
+}
+
+// the utf-8 lattice over the last bytes scanned: the positions reached by
+// stepping utf-8 widths from the position the lattice was reset to.
+// covers at least depth positions behind the newest one.
+class lattice_window {
+public:
+    explicit lattice_window(size_t depth)
+    {
+        size_t bits = sizeof(_local) * 8;
+        while (bits < depth)
+            bits <<= 1;
+        _mask = bits - 1;
+        if (bits > sizeof(_local) * 8) {
+            _heap.resize(bits / 64);
+            _bits = _heap.data();
+        }
+    }
+    lattice_window(const lattice_window&) = delete;
+    lattice_window& operator=(const lattice_window&) = delete;
+
+    // pos is a lattice position, no earlier position is pushed again
+    void reset(size_t pos) noexcept
+    {
+        _origin = pos;
+        _next = pos;
+    }
+
+    size_t origin() const noexcept
+    {
+        return _origin;
+    }
+
+    // the lattice position after the pushed ones
+    size_t next() const noexcept
+    {
+        return _next;
+    }
+
+    // scans position pos of s, positions are pushed in order
+    void push(const char* s, size_t pos) noexcept
+    {
+        uint64_t& w = _bits[(pos & _mask) >> 6];
+        const uint64_t bit = uint64_t(1) << (pos & 63);
+        if (pos == _next) {
+            w |= bit;
+            _next += utf8_step(s + pos);
+        } else {
+            w &= ~bit;
+        }
+    }
+
+    bool test(size_t pos) const noexcept
+    {
+        return 0 != (_bits[(pos & _mask) >> 6] & (uint64_t(1) << (pos & 63)));
+    }
+
+private:
+    uint64_t _local[4];
+    std::vector<uint64_t> _heap;
+    uint64_t* _bits = _local;
+    size_t _mask = 0;
+    size_t _origin = 0;
+    size_t _next = 0;
+};
+
+// whether every lattice through the lattice position origin <= pos also
+// runs through pos: no character starting in the 3 bytes before pos, and
+// not before origin, reaches over pos
+inline bool utf8_sync(const char* s, size_t origin, size_t pos) noexcept
+{
+    for (size_t k = 1; k <= 3 && pos >= origin + k; ++k) {
+        if (utf8_step(s + pos - k) > k)
+            return false;
+    }
+    return true;
+}
+
+// the first position at or after pos on the lattice through the lattice
+// position q, with origin <= q as in utf8_sync. steps from a sync point
+// just before pos when there is one, from q otherwise.
+inline size_t utf8_resync(const char* s, size_t origin, size_t q, size_t pos) noexcept
+{
+    for (size_t t = pos; t > q && pos - t < 8; --t) {
+        if (utf8_sync(s, origin, t)) {
+            q = t;
+            break;
+        }
+    }
+    while (q < pos)
+        q += utf8_step(s + q);
+    return q;
+}
+
+// position of the first byte of s in [pos, n) that can start a word, n if
+// none. checks 16 or 32 bytes at a time where ssse3 or avx2 is available.
+size_t censor_skip(const censor_prefilter& first, const char* s, size_t pos, size_t n) noexcept;
+
+// a Trie provides node_type, with node_type() for no node, root(),
+// max_depth() for the longest word, first_bytes() and child, fail, dict,
+// depth and isword of a node, as the links of censor::node.
+//
+// censor::is_word at every lattice position in one aho-corasick pass over
+// the n bytes at s, calling emit(begin, end, word node) for each match
+// until it returns false. with first set it only looks for a match and
+// returns at the first one, without calling emit.
+// the words ending at a byte are found through the dict links, longest
+// first, and the one with the leftmost lattice start is kept. it is
+// final once the automaton state no longer reaches back to its start, as
+// every later match starts at or after the start of the current state.
+// the scan then starts again from the root and a new lattice at the
+// match end. in the root state with no pending match, bytes that cannot
+// start a word are skipped with censor_skip and the lattice resynced.
+template <typename Trie, typename Emit>
+bool search_trie(const Trie& trie, const char* s, size_t n, bool first, Emit&& emit) noexcept
+{
+    using node_type = typename Trie::node_type;
+    lattice_window lattice(trie.max_depth());
+    bool ret = false;
+    size_t begin = 0;
+    size_t end = 0; // the pending match, none if 0
+    node_type word = node_type();
+    node_type cur = trie.root();
+    const censor_prefilter& prefilter = trie.first_bytes();
+    for (size_t j = 0; j < n || 0 != end; ++j) {
+        if (j < n && 0 == end && cur == trie.root() && !prefilter.test(static_cast<unsigned char>(s[j]))) {
+            const size_t pos = censor_skip(prefilter, s, j, n);
+            if (pos >= n)
+                break;
+            lattice.reset(utf8_resync(s, lattice.origin(), lattice.next(), pos));
+            j = pos;
+        }
+
+        if (j < n) {
+            lattice.push(s, j);
+
+            const auto c = static_cast<unsigned char>(s[j]);
+            node_type next = trie.child(cur, c);
+            while (node_type() == next && cur != trie.root()) {
+                cur = trie.fail(cur);
+                next = trie.child(cur, c);
+            }
+            cur = node_type() == next ? trie.root() : next;
+
+            for (node_type m = trie.isword(cur) ? cur : trie.dict(cur); node_type() != m; m = trie.dict(m)) {
+                const size_t start = j + 1 - trie.depth(m);
+                if (!lattice.test(start))
+                    continue;
+                if (first)
+                    return true;
+                if (0 == end || start < begin) {
+                    begin = start;
+                    end = j + 1;
+                    word = m;
+                }
+                break;
+            }
+        }
+
+        if (0 != end && (j >= n || j + 1 - trie.depth(cur) >= begin)) {
+            ret = true;
+            if (!emit(begin, end, word))
+                return true;
+            j = end - 1;
+            end = 0;
+            cur = trie.root();
+            lattice.reset(j + 1);
+        }
+    }
+    return ret;
+}
+
+// the censor_span callbacks, counting the spans passed on
+struct span_sink {
+    censor_span* spans;
+    size_t capacity;
+    censor_callback fn;
+    void* context;
+    size_t count;
+
+    bool operator()(size_t begin, size_t end, uint32_t word) noexcept
+    {
+        const censor_span span = { begin, end - begin, word };
+        if (nullptr == fn && count < capacity)
+            spans[count] = span;
+        ++count;
+        return nullptr == fn || fn(context, span);
+    }
+};
+
+} // namespace klib
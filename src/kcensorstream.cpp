@@ -0,0 +1,71 @@
+#include "../include/kcensorstream.h"
+#include <algorithm>
+
+namespace klib {
+
+censor_rstream::censor_rstream(rstream& stream, const censor& c, char replace, size_t chunk_size)
+    : _stream(stream)
+    , _matcher(c)
+    , _chunk(chunk_size > 0 ? chunk_size : 1, '\0')
+    , _replace(replace)
+{
+}
+
+bool censor_rstream::peek(void* data, size_t size)
+{
+    return fill(size) && _plain.peek(data, size);
+}
+
+bool censor_rstream::discard(size_t size)
+{
+    return fill(size) && _plain.discard(size);
+}
+
+bool censor_rstream::read(void* data, size_t size)
+{
+    return fill(size) && _plain.read(data, size);
+}
+
+bool censor_rstream::fill(size_t size)
+{
+    while (_plain.read_size() < size) {
+        if (_finished || !read_chunk())
+            return false;
+    }
+    return true;
+}
+
+bool censor_rstream::read_chunk()
+{
+    auto replace = [this](const censor_span& span) {
+        const size_t begin = span.offset - _released;
+        std::fill(&_window[begin], &_window[begin] + span.length, _replace);
+        return true;
+    };
+
+    // a full chunk, or the largest piece of a halved chunk that is left
+    size_t size = _chunk.size();
+    while (size > 0 && !_stream.read(&_chunk[0], size))
+        size /= 2;
+    if (0 == size) {
+        _matches += _matcher.finish(replace);
+        _finished = true;
+        return release();
+    }
+
+    _window.append(_chunk.data(), size);
+    _matches += _matcher.feed(_chunk.data(), size, replace);
+    return release();
+}
+
+bool censor_rstream::release()
+{
+    const size_t n = _matcher.committed() - _released;
+    if (!_plain.write(_window.data(), n))
+        return false;
+    _window.erase(0, n);
+    _released += n;
+    return true;
+}
+
+} // namespace klib
@@ -0,0 +1,88 @@
+#pragma once
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define KLIB_X64 1
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#include <immintrin.h>
+#endif
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#define KLIB_TARGET(x)
+#else
+#define KLIB_TARGET(x) __attribute__((target(x)))
+#endif
+
+namespace klib {
+
+// instruction set extensions usable on the running cpu, detected once
+struct cpu_features {
+    bool ssse3 = false;
+    bool sse41 = false;
+    bool sse42 = false;
+    bool pclmul = false;
+    bool avx2 = false;
+
+    cpu_features() noexcept
+    {
+#ifdef KLIB_X64
+        unsigned int r[4] = {};
+        cpuid(0, r);
+        const unsigned int max_leaf = r[0];
+        if (max_leaf < 1)
+            return;
+
+        cpuid(1, r);
+        ssse3 = 0 != (r[2] & (1u << 9));
+        sse41 = 0 != (r[2] & (1u << 19));
+        sse42 = 0 != (r[2] & (1u << 20));
+        pclmul = 0 != (r[2] & (1u << 1));
+
+        // avx state must be enabled by the os (osxsave + xcr0 bits 1,2)
+        const bool osxsave = 0 != (r[2] & (1u << 27));
+        if (max_leaf >= 7 && osxsave && (xgetbv0() & 0x6) == 0x6) {
+            cpuid(7, r);
+            avx2 = 0 != (r[1] & (1u << 5));
+        }
+#endif
+    }
+
+private:
+#ifdef KLIB_X64
+    static void cpuid(unsigned int leaf, unsigned int r[4]) noexcept
+    {
+#if defined(_MSC_VER)
+        int regs[4];
+        __cpuidex(regs, static_cast<int>(leaf), 0);
+        for (int i = 0; i < 4; ++i)
+            r[i] = static_cast<unsigned int>(regs[i]);
+#else
+        __cpuid_count(leaf, 0, r[0], r[1], r[2], r[3]);
+#endif
+    }
+
+    static unsigned long long xgetbv0() noexcept
+    {
+#if defined(_MSC_VER)
+        return _xgetbv(0);
+#else
+        unsigned int lo, hi;
+        __asm__ volatile("xgetbv"
+                         : "=a"(lo), "=d"(hi)
+                         : "c"(0));
+        return (static_cast<unsigned long long>(hi) << 32) | lo;
+#endif
+    }
+#endif
+};
+
+inline const cpu_features& get_cpu_features() noexcept
+{
+    static const cpu_features features;
+    return features;
+}
+
+} // namespace klib
@@ -1,92 +1,384 @@
 #include "../include/kcrc32.h"
+#include "kcpu.h"
+#include "kcrc32batch.h"
+#include "kcrc32clmul.h"
+#include <algorithm>
+#include <cstring>
 
 namespace {
 
-const uint32_t crc32table[0x100] = {
-    0x00000000, 0x77073096, 0xee0e612c, 0x990951ba,
-    0x076dc419, 0x706af48f, 0xe963a535, 0x9e6495a3,
-    0x0edb8832, 0x79dcb8a4, 0xe0d5e91e, 0x97d2d988,
-    0x09b64c2b, 0x7eb17cbd, 0xe7b82d07, 0x90bf1d91,
-    0x1db71064, 0x6ab020f2, 0xf3b97148, 0x84be41de,
-    0x1adad47d, 0x6ddde4eb, 0xf4d4b551, 0x83d385c7,
-    0x136c9856, 0x646ba8c0, 0xfd62f97a, 0x8a65c9ec,
-    0x14015c4f, 0x63066cd9, 0xfa0f3d63, 0x8d080df5,
-
-    0x3b6e20c8, 0x4c69105e, 0xd56041e4, 0xa2677172,
-    0x3c03e4d1, 0x4b04d447, 0xd20d85fd, 0xa50ab56b,
-    0x35b5a8fa, 0x42b2986c, 0xdbbbc9d6, 0xacbcf940,
-    0x32d86ce3, 0x45df5c75, 0xdcd60dcf, 0xabd13d59,
-    0x26d930ac, 0x51de003a, 0xc8d75180, 0xbfd06116,
-    0x21b4f4b5, 0x56b3c423, 0xcfba9599, 0xb8bda50f,
-    0x2802b89e, 0x5f058808, 0xc60cd9b2, 0xb10be924,
-    0x2f6f7c87, 0x58684c11, 0xc1611dab, 0xb6662d3d,
-
-    0x76dc4190, 0x01db7106, 0x98d220bc, 0xefd5102a,
-    0x71b18589, 0x06b6b51f, 0x9fbfe4a5, 0xe8b8d433,
-    0x7807c9a2, 0x0f00f934, 0x9609a88e, 0xe10e9818,
-    0x7f6a0dbb, 0x086d3d2d, 0x91646c97, 0xe6635c01,
-    0x6b6b51f4, 0x1c6c6162, 0x856530d8, 0xf262004e,
-    0x6c0695ed, 0x1b01a57b, 0x8208f4c1, 0xf50fc457,
-    0x65b0d9c6, 0x12b7e950, 0x8bbeb8ea, 0xfcb9887c,
-    0x62dd1ddf, 0x15da2d49, 0x8cd37cf3, 0xfbd44c65,
-
-    0x4db26158, 0x3ab551ce, 0xa3bc0074, 0xd4bb30e2,
-    0x4adfa541, 0x3dd895d7, 0xa4d1c46d, 0xd3d6f4fb,
-    0x4369e96a, 0x346ed9fc, 0xad678846, 0xda60b8d0,
-    0x44042d73, 0x33031de5, 0xaa0a4c5f, 0xdd0d7cc9,
-    0x5005713c, 0x270241aa, 0xbe0b1010, 0xc90c2086,
-    0x5768b525, 0x206f85b3, 0xb966d409, 0xce61e49f,
-    0x5edef90e, 0x29d9c998, 0xb0d09822, 0xc7d7a8b4,
-    0x59b33d17, 0x2eb40d81, 0xb7bd5c3b, 0xc0ba6cad,
-
-    0xedb88320, 0x9abfb3b6, 0x03b6e20c, 0x74b1d29a,
-    0xead54739, 0x9dd277af, 0x04db2615, 0x73dc1683,
-    0xe3630b12, 0x94643b84, 0x0d6d6a3e, 0x7a6a5aa8,
-    0xe40ecf0b, 0x9309ff9d, 0x0a00ae27, 0x7d079eb1,
-    0xf00f9344, 0x8708a3d2, 0x1e01f268, 0x6906c2fe,
-    0xf762575d, 0x806567cb, 0x196c3671, 0x6e6b06e7,
-    0xfed41b76, 0x89d32be0, 0x10da7a5a, 0x67dd4acc,
-    0xf9b9df6f, 0x8ebeeff9, 0x17b7be43, 0x60b08ed5,
-
-    0xd6d6a3e8, 0xa1d1937e, 0x38d8c2c4, 0x4fdff252,
-    0xd1bb67f1, 0xa6bc5767, 0x3fb506dd, 0x48b2364b,
-    0xd80d2bda, 0xaf0a1b4c, 0x36034af6, 0x41047a60,
-    0xdf60efc3, 0xa867df55, 0x316e8eef, 0x4669be79,
-    0xcb61b38c, 0xbc66831a, 0x256fd2a0, 0x5268e236,
-    0xcc0c7795, 0xbb0b4703, 0x220216b9, 0x5505262f,
-    0xc5ba3bbe, 0xb2bd0b28, 0x2bb45a92, 0x5cb36a04,
-    0xc2d7ffa7, 0xb5d0cf31, 0x2cd99e8b, 0x5bdeae1d,
-
-    0x9b64c2b0, 0xec63f226, 0x756aa39c, 0x026d930a,
-    0x9c0906a9, 0xeb0e363f, 0x72076785, 0x05005713,
-    0x95bf4a82, 0xe2b87a14, 0x7bb12bae, 0x0cb61b38,
-    0x92d28e9b, 0xe5d5be0d, 0x7cdcefb7, 0x0bdbdf21,
-    0x86d3d2d4, 0xf1d4e242, 0x68ddb3f8, 0x1fda836e,
-    0x81be16cd, 0xf6b9265b, 0x6fb077e1, 0x18b74777,
-    0x88085ae6, 0xff0f6a70, 0x66063bca, 0x11010b5c,
-    0x8f659eff, 0xf862ae69, 0x616bffd3, 0x166ccf45,
-
-    0xa00ae278, 0xd70dd2ee, 0x4e048354, 0x3903b3c2,
-    0xa7672661, 0xd06016f7, 0x4969474d, 0x3e6e77db,
-    0xaed16a4a, 0xd9d65adc, 0x40df0b66, 0x37d83bf0,
-    0xa9bcae53, 0xdebb9ec5, 0x47b2cf7f, 0x30b5ffe9,
-    0xbdbdf21c, 0xcabac28a, 0x53b39330, 0x24b4a3a6,
-    0xbad03605, 0xcdd70693, 0x54de5729, 0x23d967bf,
-    0xb3667a2e, 0xc4614ab8, 0x5d681b02, 0x2a6f2b94,
-    0xb40bbe37, 0xc30c8ea1, 0x5a05df1b, 0x2d02ef8d
+#ifdef KLIB_X64
+
+const size_t clmul_min_size = 64;
+
+// appends the last r (0 < r < 16) bytes of a buffer of at least 16 bytes
+// ending at end, loaded as one overlapping block and merged by byte shifts
+KLIB_TARGET("ssse3,sse4.1,pclmul")
+inline __m128i crc32_clmul_fold_tail(__m128i x, const __m128i& k3k4, const uint8_t* end, size_t r) noexcept
+{
+    static const uint8_t shuffle[48] = {
+        0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,
+        0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f,
+        0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80,
+    };
+    // x * x^(8r) + tail == head * x^128 + body, where head holds the first
+    // r bytes of x at the top and body the rest of x followed by the tail
+    const __m128i shl = _mm_loadu_si128(reinterpret_cast<const __m128i*>(shuffle + r));
+    const __m128i shr = _mm_loadu_si128(reinterpret_cast<const __m128i*>(shuffle + 16 + r));
+    const __m128i head = _mm_shuffle_epi8(x, shl);
+    const __m128i tail = _mm_and_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(end - 16)),
+        _mm_cmpgt_epi8(shl, _mm_set1_epi8(-1)));
+    const __m128i body = _mm_or_si128(_mm_shuffle_epi8(x, shr), tail);
+    const __m128i lo = _mm_clmulepi64_si128(head, k3k4, 0x00);
+    const __m128i hi = _mm_clmulepi64_si128(head, k3k4, 0x11);
+    return _mm_xor_si128(_mm_xor_si128(hi, lo), body);
+}
+
+// Folds 64-byte blocks with carry-less multiplication and Barrett-reduces
+// the remainder, see Intel's "Fast CRC Computation for Generic Polynomials
+// Using PCLMULQDQ Instruction". size must be >= 64 and a multiple of 16.
+KLIB_TARGET("sse4.1,pclmul")
+uint32_t crc32_clmul(uint32_t crc, const uint8_t* p, size_t size) noexcept
+{
+    const __m128i k1k2 = klib::crc32_k1k2();
+    const __m128i k3k4 = klib::crc32_k3k4();
+
+    __m128i x1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 0x00));
+    __m128i x2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 0x10));
+    __m128i x3 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 0x20));
+    __m128i x4 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 0x30));
+    x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(static_cast<int>(crc)));
+    p += 64;
+    size -= 64;
+
+    // fold four lanes in parallel
+    while (size >= 64) {
+        const __m128i x5 = _mm_clmulepi64_si128(x1, k1k2, 0x00);
+        const __m128i x6 = _mm_clmulepi64_si128(x2, k1k2, 0x00);
+        const __m128i x7 = _mm_clmulepi64_si128(x3, k1k2, 0x00);
+        const __m128i x8 = _mm_clmulepi64_si128(x4, k1k2, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, k1k2, 0x11);
+        x2 = _mm_clmulepi64_si128(x2, k1k2, 0x11);
+        x3 = _mm_clmulepi64_si128(x3, k1k2, 0x11);
+        x4 = _mm_clmulepi64_si128(x4, k1k2, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 0x00)));
+        x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 0x10)));
+        x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 0x20)));
+        x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 0x30)));
+        p += 64;
+        size -= 64;
+    }
+
+    // fold the four lanes into one
+    __m128i x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+    x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+    x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+    // fold the remaining 16-byte blocks
+    while (size >= 16) {
+        x1 = klib::crc32_clmul_fold(x1, k3k4, p);
+        p += 16;
+        size -= 16;
+    }
+
+    return klib::crc32_clmul_reduce(x1);
+}
+
+// crc32c has its own instruction since sse4.2
+KLIB_TARGET("sse4.2")
+uint32_t crc32c_sse42(uint32_t crc, const uint8_t* p, size_t size) noexcept
+{
+    uint64_t crc64 = crc;
+    for (; size >= 8; size -= 8, p += 8) {
+        uint64_t v;
+        std::memcpy(&v, p, sizeof(v));
+        crc64 = _mm_crc32_u64(crc64, v);
+    }
+    crc = static_cast<uint32_t>(crc64);
+    for (; size > 0; --size, ++p)
+        crc = _mm_crc32_u8(crc, *p);
+    return crc;
+}
+
+#endif
+
+uint32_t crc32_update(uint32_t crc, const uint8_t* p, size_t size) noexcept
+{
+#ifdef KLIB_X64
+    static const bool has_clmul = klib::get_cpu_features().pclmul && klib::get_cpu_features().sse41;
+    if (has_clmul && size >= clmul_min_size) {
+        const size_t folded = size & ~static_cast<size_t>(15);
+        crc = crc32_clmul(crc, p, folded);
+        p += folded;
+        size -= folded;
+    }
+#endif
+    return klib::crc32_engine::update(crc, p, size);
+}
+
+uint32_t crc32c_update(uint32_t crc, const uint8_t* p, size_t size) noexcept
+{
+#ifdef KLIB_X64
+    static const bool has_sse42 = klib::get_cpu_features().sse42;
+    if (has_sse42)
+        return crc32c_sse42(crc, p, size);
+#endif
+    return klib::crc32c_engine::update(crc, p, size);
+}
+
+// multiplies a and b modulo the reflected crc32 polynomial
+uint32_t multmodp(uint32_t a, uint32_t b) noexcept
+{
+    uint32_t m = 1u << 31;
+    uint32_t p = 0;
+    for (;;) {
+        if (a & m) {
+            p ^= b;
+            if (0 == (a & (m - 1)))
+                break;
+        }
+        m >>= 1;
+        b = (b & 1) ? (b >> 1) ^ 0xedb88320 : b >> 1;
+    }
+    return p;
+}
+
+// power[k] is x^(2^k) modulo the crc32 polynomial, the powers repeat
+// with period 32 which covers any length
+struct x2n_table {
+    uint32_t power[32];
+
+    x2n_table() noexcept
+    {
+        uint32_t p = 1u << 30; // x^1
+        power[0] = p;
+        for (size_t n = 1; n < 32; ++n)
+            power[n] = p = multmodp(p, p);
+    }
 };
 
+// x^(n * 2^k) modulo the crc32 polynomial
+uint32_t x2nmodp(size_t n, unsigned k) noexcept
+{
+    static const x2n_table table;
+    uint32_t p = 1u << 31; // x^0
+    while (n) {
+        if (n & 1)
+            p = multmodp(table.power[k & 31], p);
+        n >>= 1;
+        ++k;
+    }
+    return p;
+}
+
+const size_t batch_lanes = 4;
+
+inline uint32_t load_le32(const uint8_t* p) noexcept
+{
+    return static_cast<uint32_t>(p[0])
+        | (static_cast<uint32_t>(p[1]) << 8)
+        | (static_cast<uint32_t>(p[2]) << 16)
+        | (static_cast<uint32_t>(p[3]) << 24);
+}
+
+inline uint32_t crc32_fold8(uint32_t crc, const uint8_t* p) noexcept
+{
+    const auto& t = klib::crc32_engine::table().slice;
+    const uint32_t a = load_le32(p) ^ crc;
+    const uint32_t b = load_le32(p + 4);
+    return t[7][a & 0xff] ^ t[6][(a >> 8) & 0xff] ^ t[5][(a >> 16) & 0xff] ^ t[4][a >> 24]
+        ^ t[3][b & 0xff] ^ t[2][(b >> 8) & 0xff] ^ t[1][(b >> 16) & 0xff] ^ t[0][b >> 24];
+}
+
+} // namespace
+
+namespace klib {
+
+// runs batch_lanes table-driven crcs side by side, the lookups of one lane
+// overlap with the others' instead of waiting on its own previous step.
+// each lane takes the next buffer as soon as its current one is done, so
+// the lanes stay busy however the sizes are distributed
+void crc32_batch_table(const crc32_buffer* buffers, size_t count, uint32_t* crcs) noexcept
+{
+    uint32_t crc[batch_lanes];
+    const uint8_t* p[batch_lanes];
+    size_t left[batch_lanes];
+    size_t index[batch_lanes];
+    size_t lanes = 0;
+    size_t next = 0;
+    for (;;) {
+        while (lanes < batch_lanes && next < count) {
+            crc[lanes] = 0xffffffff;
+            p[lanes] = static_cast<const uint8_t*>(buffers[next].data);
+            left[lanes] = buffers[next].size;
+            index[lanes++] = next++;
+        }
+        if (lanes < batch_lanes)
+            break;
+
+        const size_t step = *std::min_element(left, left + batch_lanes) & ~static_cast<size_t>(7);
+        uint32_t c0 = crc[0], c1 = crc[1], c2 = crc[2], c3 = crc[3];
+        for (size_t i = 0; i < step; i += 8) {
+            c0 = crc32_fold8(c0, p[0] + i);
+            c1 = crc32_fold8(c1, p[1] + i);
+            c2 = crc32_fold8(c2, p[2] + i);
+            c3 = crc32_fold8(c3, p[3] + i);
+        }
+        crc[0] = c0, crc[1] = c1, crc[2] = c2, crc[3] = c3;
+        for (size_t k = 0; k < batch_lanes; ++k) {
+            p[k] += step;
+            left[k] -= step;
+        }
+
+        // retire the finished lanes, the last lane fills the gap
+        for (size_t k = 0; k < lanes;) {
+            if (left[k] >= 8) {
+                ++k;
+                continue;
+            }
+            crcs[index[k]] = crc32_engine::update(crc[k], p[k], left[k]) ^ 0xffffffff;
+            --lanes;
+            crc[k] = crc[lanes];
+            p[k] = p[lanes];
+            left[k] = left[lanes];
+            index[k] = index[lanes];
+        }
+    }
+
+    for (size_t k = 0; k < lanes; ++k)
+        crcs[index[k]] = crc32_update(crc[k], p[k], left[k]) ^ 0xffffffff;
+}
+
+} // namespace klib
+
+namespace {
+
+#ifdef KLIB_X64
+
+// the same lane scheme with one clmul fold register per lane, the
+// multiply latency of each lane hides behind the other lanes
+KLIB_TARGET("ssse3,sse4.1,pclmul")
+void crc32_batch_clmul(const klib::crc32_buffer* buffers, size_t count, uint32_t* crcs) noexcept
+{
+    const __m128i k3k4 = klib::crc32_k3k4();
+    __m128i x[batch_lanes];
+    const uint8_t* p[batch_lanes];
+    size_t left[batch_lanes];
+    size_t index[batch_lanes];
+    size_t lanes = 0;
+    size_t next = 0;
+    for (;;) {
+        while (lanes < batch_lanes && next < count) {
+            const uint8_t* data = static_cast<const uint8_t*>(buffers[next].data);
+            const size_t size = buffers[next].size;
+            if (size < 16) {
+                crcs[next++] = klib::crc32_engine::update(0xffffffff, data, size) ^ 0xffffffff;
+                continue;
+            }
+            x[lanes] = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data)), _mm_cvtsi32_si128(-1));
+            p[lanes] = data + 16;
+            left[lanes] = size - 16;
+            index[lanes++] = next++;
+        }
+        if (lanes < batch_lanes)
+            break;
+
+        const size_t step = *std::min_element(left, left + batch_lanes) & ~static_cast<size_t>(15);
+        __m128i x0 = x[0], x1 = x[1], x2 = x[2], x3 = x[3];
+        for (size_t i = 0; i < step; i += 16) {
+            x0 = klib::crc32_clmul_fold(x0, k3k4, p[0] + i);
+            x1 = klib::crc32_clmul_fold(x1, k3k4, p[1] + i);
+            x2 = klib::crc32_clmul_fold(x2, k3k4, p[2] + i);
+            x3 = klib::crc32_clmul_fold(x3, k3k4, p[3] + i);
+        }
+        x[0] = x0, x[1] = x1, x[2] = x2, x[3] = x3;
+        for (size_t k = 0; k < batch_lanes; ++k) {
+            p[k] += step;
+            left[k] -= step;
+        }
+
+        for (size_t k = 0; k < lanes;) {
+            if (left[k] >= 16) {
+                ++k;
+                continue;
+            }
+            if (left[k] > 0)
+                x[k] = crc32_clmul_fold_tail(x[k], k3k4, p[k] + left[k], left[k]);
+            crcs[index[k]] = klib::crc32_clmul_reduce(x[k]) ^ 0xffffffff;
+            --lanes;
+            x[k] = x[lanes];
+            p[k] = p[lanes];
+            left[k] = left[lanes];
+            index[k] = index[lanes];
+        }
+    }
+
+    for (size_t k = 0; k < lanes; ++k) {
+        const uint32_t crc = klib::crc32_clmul_reduce(x[k]);
+        crcs[index[k]] = crc32_update(crc, p[k], left[k]) ^ 0xffffffff;
+    }
+}
+
+#endif
+
 }
 
 namespace klib {
 
 uint32_t calc_crc32(const void* data, size_t size)
+{
+    return crc32_update(0xffffffff, static_cast<const uint8_t*>(data), size) ^ 0xffffffff;
+}
+
+uint32_t calc_crc32c(const void* data, size_t size)
+{
+    return crc32c_update(0xffffffff, static_cast<const uint8_t*>(data), size) ^ 0xffffffff;
+}
+
+uint32_t calc_crc32_buffers(const crc32_buffer* buffers, size_t count)
+{
+    uint32_t crc = 0xffffffff;
+    for (size_t i = 0; i < count; ++i)
+        crc = crc32_update(crc, static_cast<const uint8_t*>(buffers[i].data), buffers[i].size);
+    return crc ^ 0xffffffff;
+}
+
+#ifndef _WIN32
+uint32_t calc_crc32_iov(const struct iovec* iov, size_t count)
 {
     uint32_t crc = 0xffffffff;
-    const uint8_t* p = static_cast<const uint8_t*>(data);
-    for (size_t i = 0; i < size; ++i)
-        crc = crc32table[(crc ^ p[i]) & 0xff] ^ (crc >> 8);
+    for (size_t i = 0; i < count; ++i)
+        crc = crc32_update(crc, static_cast<const uint8_t*>(iov[i].iov_base), iov[i].iov_len);
     return crc ^ 0xffffffff;
 }
+#endif
+
+void crc32_state::update(const void* data, size_t size) noexcept
+{
+    _crc = crc32_update(_crc, static_cast<const uint8_t*>(data), size);
+}
+
+uint32_t crc32_combine(uint32_t crc_a, uint32_t crc_b, size_t len_b) noexcept
+{
+    // shift crc_a over len_b zero bytes (x^(8*len_b)), the init/xorout
+    // terms cancel out because both crcs carry them
+    return multmodp(x2nmodp(len_b, 3), crc_a) ^ crc_b;
+}
+
+void calc_crc32_batch(const crc32_buffer* buffers, size_t count, uint32_t* crcs)
+{
+#ifdef KLIB_X64
+    static const bool has_clmul = get_cpu_features().pclmul && get_cpu_features().ssse3 && get_cpu_features().sse41;
+    if (has_clmul)
+        return crc32_batch_clmul(buffers, count, crcs);
+#endif
+    crc32_batch_table(buffers, count, crcs);
+}
 
 } // namespace klib
@@ -0,0 +1,12 @@
+#pragma once
+#include "../include/kcrc32.h"
+#include <cstddef>
+#include <cstdint>
+
+namespace klib {
+
+// the table-driven kernel of calc_crc32_batch, which runs on any cpu and
+// is used where pclmul is not available
+void crc32_batch_table(const crc32_buffer* buffers, size_t count, uint32_t* crcs) noexcept;
+
+} // namespace klib
@@ -0,0 +1,59 @@
+#pragma once
+#include "kcpu.h"
+#include <cstdint>
+
+#ifdef KLIB_X64
+
+namespace klib {
+
+// bit-reflected fold constants x^(k*32) mod P: k1k2 folds 512 bits, k3k4 128
+inline __m128i crc32_k1k2() noexcept
+{
+    return _mm_set_epi64x(0x01c6e41596, 0x0154442bd4);
+}
+
+inline __m128i crc32_k3k4() noexcept
+{
+    return _mm_set_epi64x(0x00ccaa009e, 0x01751997d0);
+}
+
+// folds the 128-bit block x into the crc register
+KLIB_TARGET("sse4.1,pclmul")
+inline uint32_t crc32_clmul_reduce(__m128i x1) noexcept
+{
+    const __m128i k3k4 = crc32_k3k4();
+    // x^64 mod P and the Barrett pair
+    const __m128i k5k0 = _mm_set_epi64x(0x0000000000, 0x0163cd6124);
+    const __m128i poly = _mm_set_epi64x(0x01f7011641, 0x01db710641);
+    const __m128i mask32 = _mm_setr_epi32(~0, 0, ~0, 0);
+    __m128i x2;
+
+    // 128 bits to 64 bits
+    x2 = _mm_clmulepi64_si128(x1, k3k4, 0x10);
+    x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_and_si128(x1, mask32);
+    x1 = _mm_clmulepi64_si128(x1, k5k0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    // Barrett reduction to 32 bits
+    x2 = _mm_and_si128(x1, mask32);
+    x2 = _mm_clmulepi64_si128(x2, poly, 0x10);
+    x2 = _mm_and_si128(x2, mask32);
+    x2 = _mm_clmulepi64_si128(x2, poly, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+    return static_cast<uint32_t>(_mm_extract_epi32(x1, 1));
+}
+
+// x * x^128 + block, i.e. appends 16 bytes to the folded value x
+KLIB_TARGET("sse4.1,pclmul")
+inline __m128i crc32_clmul_fold(__m128i x, const __m128i& k3k4, const uint8_t* p) noexcept
+{
+    const __m128i lo = _mm_clmulepi64_si128(x, k3k4, 0x00);
+    const __m128i hi = _mm_clmulepi64_si128(x, k3k4, 0x11);
+    return _mm_xor_si128(_mm_xor_si128(hi, lo), _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)));
+}
+
+} // namespace klib
+
+#endif
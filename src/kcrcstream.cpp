@@ -0,0 +1,63 @@
+#include "../include/kcrcstream.h"
+
+namespace klib {
+
+bool crc_wstream::write(const void* data, size_t size)
+{
+    if (!_stream.write(data, size))
+        return false;
+    _crc.update(data, size);
+    return true;
+}
+
+bool crc_wstream::write_crc()
+{
+    const uint32_t crc = _crc.finalize();
+    const uint8_t bytes[4] = {
+        static_cast<uint8_t>(crc),
+        static_cast<uint8_t>(crc >> 8),
+        static_cast<uint8_t>(crc >> 16),
+        static_cast<uint8_t>(crc >> 24),
+    };
+    return _stream.write(bytes, sizeof(bytes));
+}
+
+bool crc_rstream::peek(void* data, size_t size)
+{
+    return _stream.peek(data, size);
+}
+
+bool crc_rstream::discard(size_t size)
+{
+    // the skipped bytes still belong to the checksum
+    uint8_t buf[256];
+    while (size > 0) {
+        const size_t n = size < sizeof(buf) ? size : sizeof(buf);
+        if (!read(buf, n))
+            return false;
+        size -= n;
+    }
+    return true;
+}
+
+bool crc_rstream::read(void* data, size_t size)
+{
+    if (!_stream.read(data, size))
+        return false;
+    _crc.update(data, size);
+    return true;
+}
+
+bool crc_rstream::check_crc()
+{
+    uint8_t bytes[4];
+    if (!_stream.read(bytes, sizeof(bytes)))
+        return false;
+    const uint32_t crc = static_cast<uint32_t>(bytes[0])
+        | (static_cast<uint32_t>(bytes[1]) << 8)
+        | (static_cast<uint32_t>(bytes[2]) << 16)
+        | (static_cast<uint32_t>(bytes[3]) << 24);
+    return crc == _crc.finalize();
+}
+
+} // namespace klib
@@ -0,0 +1,97 @@
+#include "../include/kworker.h"
+
+namespace klib {
+
+namespace {
+
+// the pool whose job the current thread is working on
+thread_local const worker_pool* current_pool = nullptr;
+
+} // namespace
+
+worker_pool::worker_pool(unsigned threads)
+{
+    if (0 == threads)
+        threads = std::thread::hardware_concurrency();
+    for (unsigned i = 1; i < threads; ++i)
+        _threads.emplace_back(&worker_pool::run, this);
+}
+
+worker_pool::~worker_pool()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stop = true;
+    }
+    _wake.notify_all();
+    for (auto& t : _threads)
+        t.join();
+}
+
+void worker_pool::parallel_for(size_t count, const std::function<void(size_t, size_t)>& fn)
+{
+    if (0 == count)
+        return;
+    // nested calls would wait for the job they are part of
+    if (_threads.empty() || 1 == count || this == current_pool) {
+        fn(0, count);
+        return;
+    }
+
+    std::lock_guard<std::mutex> job(_job_mutex);
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _fn = &fn;
+        _count = count;
+        // a few ranges per thread so uneven ranges even out
+        _grain = count / (size() * 4);
+        if (0 == _grain)
+            _grain = 1;
+        _next = 0;
+        _busy = _threads.size();
+        ++_generation;
+    }
+    _wake.notify_all();
+
+    work();
+
+    std::unique_lock<std::mutex> lock(_mutex);
+    _done.wait(lock, [this] { return 0 == _busy; });
+    _fn = nullptr;
+}
+
+void worker_pool::run() noexcept
+{
+    uint64_t generation = 0;
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _wake.wait(lock, [this, generation] { return _stop || _generation != generation; });
+            if (_stop)
+                return;
+            generation = _generation;
+        }
+
+        work();
+
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (0 == --_busy)
+            _done.notify_one();
+    }
+}
+
+void worker_pool::work() noexcept
+{
+    const worker_pool* outer = current_pool;
+    current_pool = this;
+    for (;;) {
+        const size_t begin = _next.fetch_add(_grain);
+        if (begin >= _count)
+            break;
+        const size_t end = _count - begin < _grain ? _count : begin + _grain;
+        (*_fn)(begin, end);
+    }
+    current_pool = outer;
+}
+
+} // namespace klib
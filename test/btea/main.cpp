@@ -0,0 +1,362 @@
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include "../doctest.h"
+#include <kbtea.h>
+#include <kbteachunked.h>
+#include <kbteastream.h>
+#include <kcrc32.h>
+#include <algorithm>
+#include <cstring>
+#include <random>
+#include <vector>
+
+TEST_SUITE_BEGIN("btea");
+using namespace klib;
+
+namespace {
+
+std::vector<uint32_t> random_words(size_t size, std::mt19937& rng)
+{
+    std::vector<uint32_t> data(size);
+    for (auto& w : data)
+        w = rng();
+    return data;
+}
+
+// plain xxtea encoding without the fixed size dispatch
+void reference_btea(uint32_t* v, uint32_t n, const uint32_t key[4])
+{
+    uint32_t sum = 0;
+    uint32_t z = v[n - 1];
+    for (uint32_t rounds = 6 + 52 / n; rounds > 0; --rounds) {
+        sum += 0x9e3779b9;
+        const uint32_t e = (sum >> 2) & 3;
+        for (uint32_t p = 0; p < n; ++p) {
+            const uint32_t y = v[(p + 1) % n];
+            z = v[p] += ((z >> 5 ^ y << 2) + (y >> 3 ^ z << 4)) ^ ((sum ^ y) + (key[(p & 3) ^ e] ^ z));
+        }
+    }
+}
+
+template <int32_t N>
+void check_fixed_btea(std::mt19937& rng)
+{
+    const auto key = random_words(4, rng);
+    const auto plain = random_words(N, rng);
+    auto expect = plain;
+    reference_btea(expect.data(), N, key.data());
+
+    auto data = plain;
+    btea<N>(data.data(), key.data());
+    CHECK(expect == data);
+    btea<-N>(data.data(), key.data());
+    CHECK(plain == data);
+
+    data = plain;
+    btea(data.data(), N, key.data());
+    CHECK(expect == data);
+    btea(data.data(), -N, key.data());
+    CHECK(plain == data);
+}
+
+} // namespace
+
+TEST_CASE("btea round trip")
+{
+    std::mt19937 rng(1);
+    const auto key = random_words(4, rng);
+    for (int32_t num = 2; num < 64; ++num) {
+        const auto plain = random_words(static_cast<size_t>(num), rng);
+        auto data = plain;
+        btea(data.data(), num, key.data());
+        CHECK(plain != data);
+        btea(data.data(), -num, key.data());
+        CHECK(plain == data);
+    }
+}
+
+TEST_CASE("btea<N> matches btea")
+{
+    std::mt19937 rng(5);
+    check_fixed_btea<2>(rng);
+    check_fixed_btea<3>(rng);
+    check_fixed_btea<4>(rng);
+    check_fixed_btea<5>(rng);
+    check_fixed_btea<8>(rng);
+    check_fixed_btea<16>(rng);
+    check_fixed_btea<32>(rng);
+    check_fixed_btea<53>(rng);
+}
+
+TEST_CASE("btea bytes")
+{
+    std::mt19937 rng(6);
+    const auto key = random_words(4, rng);
+    for (size_t size : { 0, 1, 3, 4, 7, 8, 9, 100, 1023 }) {
+        const size_t padded = btea_padded_size(size);
+        CHECK(padded > size);
+        CHECK(padded >= 8);
+        CHECK(0 == padded % 4);
+
+        std::vector<uint8_t> plain(size);
+        for (auto& c : plain)
+            c = static_cast<uint8_t>(rng());
+
+        std::vector<uint8_t> expect;
+        for (size_t offset = 0; offset < 4; ++offset) {
+            std::vector<uint8_t> buf(offset + padded);
+            uint8_t* p = buf.data() + offset;
+            std::copy(plain.begin(), plain.end(), p);
+            CHECK(0 == btea_encrypt_bytes(p, size, padded - 1, key.data()));
+            REQUIRE(padded == btea_encrypt_bytes(p, size, padded, key.data()));
+            // the same cipher text at every alignment
+            if (0 == offset)
+                expect.assign(p, p + padded);
+            CHECK(std::equal(expect.begin(), expect.end(), p));
+
+            size_t plain_size = 0;
+            REQUIRE(btea_decrypt_bytes(p, padded, key.data(), plain_size));
+            CHECK(size == plain_size);
+            CHECK(std::equal(plain.begin(), plain.end(), p));
+        }
+
+        // padded plain text is plain btea on the words
+        std::vector<uint32_t> words(padded / 4);
+        std::memcpy(words.data(), plain.data(), size);
+        reinterpret_cast<uint8_t*>(words.data())[size] = 0x80;
+        btea(words.data(), static_cast<int32_t>(words.size()), key.data());
+        CHECK(0 == std::memcmp(words.data(), expect.data(), padded));
+
+        size_t plain_size = 0;
+        auto bad = expect;
+        CHECK(!btea_decrypt_bytes(bad.data(), bad.size() - 1, key.data(), plain_size));
+        bad.back() ^= 1;
+        CHECK(!btea_decrypt_bytes(bad.data(), bad.size(), key.data(), plain_size));
+    }
+}
+
+TEST_CASE("btea seal and open")
+{
+    std::mt19937 rng(7);
+    const auto key = random_words(4, rng);
+    for (size_t size : { 0, 1, 4, 7, 8, 100, 1023 }) {
+        const size_t sealed = btea_sealed_size(size);
+        std::vector<uint8_t> plain(size);
+        for (auto& c : plain)
+            c = static_cast<uint8_t>(rng());
+
+        for (size_t offset = 0; offset < 2; ++offset) {
+            std::vector<uint8_t> buf(offset + sealed);
+            uint8_t* p = buf.data() + offset;
+            std::copy(plain.begin(), plain.end(), p);
+            CHECK(0 == btea_seal(p, size, sealed - 1, key.data()));
+            REQUIRE(sealed == btea_seal(p, size, sealed, key.data()));
+
+            // the same cipher text as btea_encrypt_bytes, then its crc
+            std::vector<uint8_t> expect(plain);
+            expect.resize(sealed - 4);
+            REQUIRE(sealed - 4 == btea_encrypt_bytes(expect.data(), size, expect.size(), key.data()));
+            CHECK(std::equal(expect.begin(), expect.end(), p));
+            const uint32_t crc = calc_crc32(expect.data(), expect.size());
+            CHECK(p[sealed - 4] == static_cast<uint8_t>(crc));
+            CHECK(p[sealed - 1] == static_cast<uint8_t>(crc >> 24));
+
+            // a damaged packet is rejected before it is decrypted
+            std::vector<uint8_t> bad(p, p + sealed);
+            bad[rng() % sealed] ^= 0x10;
+            const auto damaged = bad;
+            size_t plain_size = 0;
+            CHECK(!btea_open(bad.data(), bad.size(), key.data(), plain_size));
+            CHECK(damaged == bad);
+            CHECK(!btea_open(p, sealed - 1, key.data(), plain_size));
+
+            REQUIRE(btea_open(p, sealed, key.data(), plain_size));
+            CHECK(size == plain_size);
+            CHECK(std::equal(plain.begin(), plain.end(), p));
+        }
+    }
+}
+
+TEST_CASE("btea_batch matches btea")
+{
+    std::mt19937 rng(2);
+    for (size_t count : { 0, 1, 3, 4, 7, 8, 13, 21 }) {
+        for (int32_t num : { 2, 3, 4, 5, 8, 16, 33 }) {
+            std::vector<std::vector<uint32_t>> keys(count), expect(count), batch(count);
+            std::vector<uint32_t*> data(count);
+            std::vector<const uint32_t*> key_ptrs(count);
+            for (size_t i = 0; i < count; ++i) {
+                keys[i] = random_words(4, rng);
+                expect[i] = batch[i] = random_words(static_cast<size_t>(num), rng);
+                data[i] = batch[i].data();
+                key_ptrs[i] = keys[i].data();
+            }
+
+            for (int32_t n : { num, -num }) {
+                for (size_t i = 0; i < count; ++i)
+                    btea(expect[i].data(), n, keys[i].data());
+                btea_batch(data.data(), count, n, key_ptrs.data());
+                for (size_t i = 0; i < count; ++i)
+                    REQUIRE(expect[i] == batch[i]);
+            }
+        }
+    }
+}
+
+TEST_CASE("btea_ctr random access")
+{
+    std::mt19937 rng(4);
+    const auto key = random_words(4, rng);
+    std::vector<uint8_t> plain(5000);
+    for (auto& c : plain)
+        c = static_cast<uint8_t>(rng());
+
+    const btea_ctr ctr(key.data(), 0x0123456789abcdef);
+    auto cipher = plain;
+    ctr.crypt(cipher.data(), cipher.size(), 0);
+    CHECK(plain != cipher);
+
+    for (int i = 0; i < 100; ++i) {
+        const size_t offset = rng() % plain.size();
+        const size_t size = rng() % (plain.size() - offset + 1);
+        std::vector<uint8_t> part(cipher.begin() + offset, cipher.begin() + offset + size);
+        ctr.crypt(part.data(), part.size(), offset);
+        REQUIRE(std::equal(part.begin(), part.end(), plain.begin() + offset));
+    }
+
+    auto other = plain;
+    btea_ctr(key.data(), 1).crypt(other.data(), other.size(), 0);
+    CHECK(cipher != other);
+}
+
+TEST_CASE("btea_wstream and btea_rstream")
+{
+    std::mt19937 rng(3);
+    const auto key = random_words(4, rng);
+    const size_t chunk_words = 8;
+    const size_t chunk_size = chunk_words * 4;
+
+    for (size_t size : { 0, 1, 31, 32, 33, 64, 1000 }) {
+        std::vector<uint8_t> plain(size);
+        for (auto& c : plain)
+            c = static_cast<uint8_t>(rng());
+
+        memstream m;
+        {
+            btea_wstream s(m, key.data(), chunk_words);
+            for (size_t pos = 0; pos < size;) {
+                const size_t n = std::min<size_t>(rng() % 50, size - pos);
+                CHECK(s.write(&plain[pos], n));
+                pos += n;
+            }
+            CHECK(s.finish());
+        }
+        CHECK((size / chunk_size + 1) * chunk_size == m.read_size());
+        if (size >= 8)
+            CHECK(0 != std::memcmp(m.read_ptr(), plain.data(), 8));
+
+        memstream corrupt(m);
+        {
+            btea_rstream s(m, key.data(), chunk_words);
+            std::vector<uint8_t> out(size);
+            for (size_t pos = 0; pos < size;) {
+                const size_t n = std::min<size_t>(rng() % 50, size - pos);
+                CHECK(s.read(&out[pos], n));
+                pos += n;
+            }
+            CHECK(plain == out);
+            uint8_t c;
+            CHECK(!s.peek(c));
+            CHECK(0 == m.read_size());
+        }
+
+        // a damaged chunk never decrypts to the original bytes
+        corrupt.read_ptr()[0] ^= 0x01;
+        if (size > 0) {
+            btea_rstream s(corrupt, key.data(), chunk_words);
+            std::vector<uint8_t> out(size);
+            CHECK(!(s.read(out.data(), size) && out == plain));
+        }
+    }
+}
+
+TEST_CASE("worker_pool")
+{
+    for (unsigned threads : { 1, 4 }) {
+        worker_pool pool(threads);
+        CHECK(threads == pool.size());
+        for (size_t count : { 0, 1, 7, 1000 }) {
+            std::vector<std::atomic<int>> hits(count);
+            for (auto& h : hits)
+                h = 0;
+            pool.parallel_for(count, [&](size_t begin, size_t end) {
+                for (size_t i = begin; i < end; ++i)
+                    ++hits[i];
+            });
+            CHECK(std::all_of(hits.begin(), hits.end(), [](const std::atomic<int>& h) { return 1 == h; }));
+        }
+
+        // nested calls on the same pool run inline instead of deadlocking
+        std::vector<std::atomic<int>> hits(64 * 64);
+        for (auto& h : hits)
+            h = 0;
+        pool.parallel_for(64, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                pool.parallel_for(64, [&](size_t b, size_t e) {
+                    for (size_t k = b; k < e; ++k)
+                        ++hits[i * 64 + k];
+                });
+            }
+        });
+        CHECK(std::all_of(hits.begin(), hits.end(), [](const std::atomic<int>& h) { return 1 == h; }));
+    }
+}
+
+TEST_CASE("btea chunked")
+{
+    std::mt19937 rng(4);
+    const auto key = random_words(4, rng);
+    const size_t chunk_words = 16;
+    const size_t chunk_size = chunk_words * 4;
+    worker_pool pool(4);
+    worker_pool single(1);
+
+    for (size_t size : { 0, 1, 5, 63, 64, 65, 1000, 100000 }) {
+        std::vector<uint8_t> plain(size);
+        for (auto& c : plain)
+            c = static_cast<uint8_t>(rng());
+
+        memstream m;
+        btea_encrypt_chunked(plain.data(), size, key.data(), m, pool, chunk_words);
+        REQUIRE(btea_chunked_size(size, chunk_words) == m.read_size());
+
+        memstream m1;
+        btea_encrypt_chunked(plain.data(), size, key.data(), m1, single, chunk_words);
+        REQUIRE(m1.read_size() == m.read_size());
+        CHECK(0 == std::memcmp(m.read_ptr(), m1.read_ptr(), m.read_size()));
+
+        // every chunk is plain btea
+        const uint8_t* cipher = m.read_ptr() + btea_chunked_header_size;
+        for (size_t offset = 0; offset < size; offset += chunk_size) {
+            const size_t n = std::min(chunk_size, size - offset);
+            std::vector<uint32_t> words(std::max<size_t>(2, (n + 3) / 4));
+            std::memcpy(words.data(), &plain[offset], n);
+            btea(words.data(), static_cast<int32_t>(words.size()), key.data());
+            REQUIRE(0 == std::memcmp(words.data(), cipher + offset, words.size() * 4));
+        }
+
+        memstream out;
+        REQUIRE(btea_decrypt_chunked(m.read_ptr(), m.read_size(), key.data(), out, pool));
+        REQUIRE(size == out.read_size());
+        CHECK(0 == std::memcmp(out.read_ptr(), plain.data(), size));
+
+        std::vector<uint8_t> bad(m.read_ptr(), m.read_ptr() + m.read_size());
+        memstream none;
+        CHECK(!btea_decrypt_chunked(bad.data(), bad.size() - 1, key.data(), none, pool));
+        bad[0] ^= 1;
+        CHECK(!btea_decrypt_chunked(bad.data(), bad.size(), key.data(), none, pool));
+        bad[0] ^= 1;
+        bad[10] ^= 1;
+        CHECK(!btea_decrypt_chunked(bad.data(), bad.size(), key.data(), none, pool));
+        CHECK(0 == none.read_size());
+    }
+}
@@ -0,0 +1,720 @@
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include "../doctest.h"
+#include <kcensor.h>
+#include <kcensorfile.h>
+#include <kcensorstream.h>
+#include <kcrc32.h>
+#include <kstream.h>
+#include <kworker.h>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <random>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+TEST_SUITE_BEGIN("censor");
+using namespace klib;
+
+namespace {
+
+size_t reference_width(unsigned char c)
+{
+    if (c < 0x80)
+        return 1;
+    if ((c & 0xe0) == 0xc0)
+        return 2;
+    if ((c & 0xf0) == 0xe0)
+        return 3;
+    if ((c & 0xf8) == 0xf0)
+        return 4;
+    return 1;
+}
+
+// shortest word at every utf-8 lead position, scanning on after a match
+bool reference_filter(const std::set<std::string>& words, std::string& sentence, char replace = '*')
+{
+    bool ret = false;
+    for (size_t i = 0, n = sentence.size(); i < n;) {
+        size_t len = 0;
+        for (const auto& w : words) {
+            if (!w.empty() && (0 == len || w.size() < len) && 0 == sentence.compare(i, w.size(), w))
+                len = w.size();
+        }
+        if (0 != len) {
+            std::fill(&sentence[i], &sentence[i] + len, replace);
+            i += len;
+            ret = true;
+        } else {
+            i += reference_width(static_cast<unsigned char>(sentence[i]));
+        }
+    }
+    return ret;
+}
+
+// ascii, 2, 3 and 4 byte characters, stray continuation and invalid bytes
+std::string random_text(std::mt19937& rng, size_t chars)
+{
+    static const char* const pieces[] = { "a", "b", "c", "\xc3\xa9", "\xe4\xbd\xa0", "\xe5\xa5\xbd",
+        "\xf0\x9f\x98\x80", "\x80", "\xbd", "\xff", "\xe4" };
+    std::string s;
+    for (size_t i = 0; i < chars; ++i)
+        s += pieces[rng() % (sizeof(pieces) / sizeof(pieces[0]))];
+    return s;
+}
+
+// the saved dictionary in an 8 byte aligned buffer
+std::vector<uint64_t> saved(const censor& c, size_t& size)
+{
+    memstream m;
+    REQUIRE(c.save(m));
+    size = m.read_size();
+    std::vector<uint64_t> data((size + 7) / 8);
+    std::memcpy(data.data(), m.read_ptr(), size);
+    return data;
+}
+
+} // namespace
+
+TEST_CASE("censor words")
+{
+    censor c;
+    c.add_word("bad");
+    c.add_word("\xe5\x9d\x8f"); // 坏
+    c.add_word("\xff\xfe");
+
+    CHECK(c.has_word("a bad day"));
+    CHECK(c.has_word("\xe5\x9d\x8f"));
+    CHECK(c.has_word("x\xff\xfe"));
+    CHECK(!c.has_word("a ba day"));
+    CHECK(!c.has_word(""));
+
+    std::string s = "bad \xe5\x9d\x8f bad\xff\xfe";
+    CHECK(c.filter_word(s));
+    CHECK("*** *** *****" == s);
+
+    s = "good";
+    CHECK(!c.filter_word(s, '#'));
+    CHECK("good" == s);
+}
+
+TEST_CASE("censor matches only at utf-8 boundaries")
+{
+    censor c;
+    c.add_word("\xbd\xa0");
+    // the word is the tail of 你, which is skipped as one character
+    CHECK(!c.has_word("\xe4\xbd\xa0"));
+    CHECK(c.has_word("\xbd\xa0"));
+}
+
+TEST_CASE("censor random")
+{
+    std::mt19937 rng(1);
+    for (int round = 0; round < 50; ++round) {
+        censor c;
+        std::set<std::string> words;
+        for (size_t i = 0, n = rng() % 20; i < n; ++i) {
+            const auto w = random_text(rng, 1 + rng() % 3);
+            words.insert(w);
+            c.add_word(w);
+        }
+        for (int k = 0; k < 20; ++k) {
+            const auto text = random_text(rng, rng() % 40);
+            auto expect = text;
+            const bool found = reference_filter(words, expect);
+            CHECK(found == c.has_word(text));
+            auto filtered = text;
+            CHECK(found == c.filter_word(filtered));
+            CHECK(expect == filtered);
+        }
+    }
+}
+
+TEST_CASE("censor skips text that cannot match")
+{
+    // few first bytes, long texts, so most of the text is skipped
+    std::mt19937 rng(6);
+    for (int round = 0; round < 50; ++round) {
+        censor trie;
+        censor automaton;
+        std::set<std::string> words;
+        for (size_t i = 0, n = 1 + rng() % 3; i < n; ++i) {
+            const auto w = random_text(rng, 1 + rng() % 3);
+            words.insert(w);
+            trie.add_word(w);
+            automaton.add_word(w);
+        }
+        automaton.compile();
+
+        for (int k = 0; k < 10; ++k) {
+            const auto text = random_text(rng, 200 + rng() % 300);
+            auto expect = text;
+            const bool found = reference_filter(words, expect);
+            CHECK(found == trie.has_word(text));
+            CHECK(found == automaton.has_word(text));
+            auto a = text;
+            auto b = text;
+            trie.filter_word(a);
+            automaton.filter_word(b);
+            CHECK(expect == a);
+            CHECK(expect == b);
+        }
+    }
+}
+
+TEST_CASE("censor compiled matches the trie scan")
+{
+    std::mt19937 rng(3);
+    for (int round = 0; round < 200; ++round) {
+        censor trie;
+        censor automaton;
+        for (size_t i = 0, n = rng() % 30; i < n; ++i) {
+            const auto w = random_text(rng, 1 + rng() % 5);
+            trie.add_word(w);
+            automaton.add_word(w);
+        }
+        automaton.compile();
+        CHECK(automaton.compiled());
+        CHECK(!trie.compiled());
+
+        for (int k = 0; k < 50; ++k) {
+            const auto text = random_text(rng, rng() % 100);
+            CHECK(trie.has_word(text) == automaton.has_word(text));
+            auto expect = text;
+            auto filtered = text;
+            CHECK(trie.filter_word(expect) == automaton.filter_word(filtered));
+            CHECK(expect == filtered);
+        }
+    }
+
+    censor c;
+    c.add_word("abc");
+    c.compile();
+    c.add_word("a");
+    CHECK(!c.compiled());
+    std::string s = "abc";
+    CHECK(c.filter_word(s));
+    CHECK("*bc" == s);
+}
+
+TEST_CASE("censor spans")
+{
+    censor c;
+    CHECK(0 == c.add_word("bad"));
+    CHECK(1 == c.add_word("\xe5\x9d\x8f"));
+    CHECK(0 == c.add_word("bad"));
+    CHECK(2 == c.add_word("ugly"));
+
+    const std::string text = "bad, \xe5\x9d\x8f and ugly";
+    for (int compiled = 0; compiled < 2; ++compiled) {
+        if (compiled)
+            c.compile();
+        censor_span spans[4];
+        REQUIRE(3 == c.find_words(text.data(), text.size(), spans, 4));
+        CHECK(0 == spans[0].offset);
+        CHECK(3 == spans[0].length);
+        CHECK(0 == spans[0].word);
+        CHECK(5 == spans[1].offset);
+        CHECK(3 == spans[1].length);
+        CHECK(1 == spans[1].word);
+        CHECK(13 == spans[2].offset);
+        CHECK(4 == spans[2].length);
+        CHECK(2 == spans[2].word);
+
+        // the count of all matches, even past the capacity
+        censor_span one;
+        CHECK(3 == c.find_words(text.data(), text.size(), &one, 1));
+        CHECK(0 == one.offset);
+        CHECK(3 == c.find_words(text.data(), text.size(), nullptr, 0));
+
+        std::vector<uint32_t> words;
+        auto stop_after_two = [&words](const censor_span& span) {
+            words.push_back(span.word);
+            return words.size() < 2;
+        };
+        CHECK(2 == c.for_each_word(text.data(), text.size(), stop_after_two));
+        CHECK((std::vector<uint32_t> { 0, 1 }) == words);
+    }
+}
+
+TEST_CASE("censor spans match filter_word")
+{
+    std::mt19937 rng(5);
+    for (int round = 0; round < 100; ++round) {
+        censor c;
+        std::vector<std::string> words;
+        for (size_t i = 0, n = rng() % 20; i < n; ++i) {
+            const auto w = random_text(rng, 1 + rng() % 4);
+            if (words.size() == c.add_word(w))
+                words.push_back(w);
+        }
+        if (round % 2)
+            c.compile();
+        size_t size = 0;
+        censor_view view;
+        std::vector<uint64_t> data;
+        if (c.compiled()) {
+            data = saved(c, size);
+            REQUIRE(view.open(data.data(), size));
+        }
+
+        for (int k = 0; k < 20; ++k) {
+            const auto text = random_text(rng, rng() % 60);
+            auto expect = text;
+            c.filter_word(expect, '#');
+
+            std::vector<censor_span> spans(text.size());
+            spans.resize(c.find_words(text.data(), text.size(), spans.data(), spans.size()));
+            auto replaced = text;
+            for (const auto& span : spans) {
+                CHECK(0 == text.compare(span.offset, span.length, words.at(span.word)));
+                replaced.replace(span.offset, span.length, span.length, '#');
+            }
+            CHECK(expect == replaced);
+
+            if (view.valid()) {
+                std::vector<censor_span> other(text.size());
+                other.resize(view.find_words(text.data(), text.size(), other.data(), other.size()));
+                REQUIRE(spans.size() == other.size());
+                for (size_t i = 0; i < spans.size(); ++i) {
+                    CHECK(spans[i].offset == other[i].offset);
+                    CHECK(spans[i].length == other[i].length);
+                    CHECK(spans[i].word == other[i].word);
+                }
+            }
+        }
+    }
+}
+
+TEST_CASE("censor folding")
+{
+    censor_fold fold;
+    fold.map(0x0430, 'a'); // cyrillic a
+    fold.map('0', 'o');
+    fold.skip_classes = censor_fold::skip_punct | censor_fold::skip_space;
+
+    CHECK("bad" == fold.apply("B.A D"));
+    CHECK("bad" == fold.apply("\xef\xbc\xa2\xef\xbc\xa1\xef\xbc\xa4")); // full width BAD
+
+    censor c;
+    c.add_word(fold.apply("bad"));
+    c.add_word(fold.apply("foo"));
+    c.add_word("\xe4\xbd\xa0\xe5\xa5\xbd");
+
+    CHECK(!c.has_word("BAD"));
+    CHECK(c.has_word("BAD", fold));
+    CHECK(c.has_word("b\xd0\xb0" "d", fold)); // cyrillic a
+    CHECK(c.has_word("f00", fold));
+    CHECK(c.has_word("\xef\xbd\x86\xef\xbd\x8f\xef\xbd\x8f", fold)); // full width foo
+    CHECK(c.has_word("\xe4\xbd\xa0 \xe5\xa5\xbd", fold));
+    CHECK(!c.has_word("ba", fold));
+    CHECK(!c.has_word("b\xe4\xbd\xa0" "ad", fold));
+
+    // skipped characters never start a word, the spans cover the original
+    std::string s = "x .B-a D! f.0.o";
+    censor_span spans[4];
+    REQUIRE(2 == c.find_words(s.data(), s.size(), fold, spans, 4));
+    CHECK(3 == spans[0].offset);
+    CHECK(5 == spans[0].length);
+    CHECK(0 == spans[0].word);
+    CHECK(10 == spans[1].offset);
+    CHECK(5 == spans[1].length);
+    CHECK(1 == spans[1].word);
+    CHECK(c.filter_word(s, fold));
+    CHECK("x .*****! *****" == s);
+
+    // without skipping, only case and width are folded
+    censor_fold plain;
+    CHECK(c.has_word("xBaDx", plain));
+    CHECK(!c.has_word("b.a.d", plain));
+    CHECK(!c.has_word("f00", plain));
+
+    // invalid and truncated utf-8 is matched as raw bytes
+    censor raw;
+    raw.add_word("a\xff");
+    raw.add_word("\xe4\xbd");
+    CHECK(raw.has_word("A\xff", plain));
+    std::string t = "x\xe4\xbd";
+    CHECK(raw.filter_word(t, plain));
+    CHECK("x**" == t);
+
+    // without folding the scan matches the plain one
+    censor_fold none;
+    none.lower_case = false;
+    none.half_width = false;
+    std::mt19937 rng(7);
+    std::set<std::string> words;
+    censor r;
+    for (int i = 0; i < 50; ++i) {
+        const std::string w = random_text(rng, 1 + rng() % 3);
+        words.insert(w);
+        r.add_word(w);
+    }
+    for (int i = 0; i < 500; ++i) {
+        std::string a = random_text(rng, rng() % 40);
+        std::string b = a;
+        CHECK(r.filter_word(a, none) == r.filter_word(b));
+        CHECK(a == b);
+    }
+}
+
+TEST_CASE("censor matcher")
+{
+    std::mt19937 rng(11);
+    for (int round = 0; round < 2; ++round) {
+        censor c;
+        for (int i = 0; i < 40; ++i)
+            c.add_word(random_text(rng, 1 + rng() % 4));
+        if (1 == round)
+            c.compile();
+
+        for (int i = 0; i < 200; ++i) {
+            const std::string text = random_text(rng, rng() % 60);
+            std::vector<censor_span> expected;
+            auto collect = [&expected](const censor_span& span) {
+                expected.push_back(span);
+                return true;
+            };
+            c.for_each_word(text.data(), text.size(), collect);
+
+            std::vector<censor_span> found;
+            auto keep = [&found](const censor_span& span) {
+                found.push_back(span);
+                return true;
+            };
+            censor_matcher m(c);
+            size_t count = 0;
+            for (size_t pos = 0; pos < text.size();) {
+                const size_t n = std::min<size_t>(rng() % 5, text.size() - pos);
+                count += m.feed(text.data() + pos, n, keep);
+                CHECK(m.committed() <= m.offset());
+                pos += n;
+            }
+            count += m.finish(keep);
+            CHECK(text.size() == m.offset());
+            CHECK(m.offset() == m.committed());
+            REQUIRE(expected.size() == found.size());
+            CHECK(count == found.size());
+            for (size_t k = 0; k < found.size(); ++k) {
+                CHECK(expected[k].offset == found[k].offset);
+                CHECK(expected[k].length == found[k].length);
+                CHECK(expected[k].word == found[k].word);
+            }
+        }
+    }
+
+    // a word split across feeds, with offsets from the start of the stream
+    censor c;
+    c.add_word("banned");
+    std::vector<censor_span> found;
+    auto keep = [&found](const censor_span& span) {
+        found.push_back(span);
+        return true;
+    };
+    censor_matcher m(c);
+    CHECK(0 == m.feed("xx ban", 6, keep));
+    CHECK(2 == m.feed("ned yy banned b", 15, keep));
+    CHECK(0 == m.feed("an", 2, keep));
+    CHECK(1 == m.feed("ned", 3, keep));
+    CHECK(0 == m.feed("ban", 3, keep));
+    CHECK(0 == m.finish(keep));
+    CHECK(0 == m.feed("ned", 3, keep));
+    CHECK(0 == m.finish(keep));
+    CHECK(1 == m.feed("banned", 6, keep));
+    REQUIRE(4 == found.size());
+    CHECK(3 == found[0].offset);
+    CHECK(13 == found[1].offset);
+    CHECK(20 == found[2].offset);
+    CHECK(6 == found[2].length);
+    CHECK(32 == found[3].offset);
+
+    // stopping leaves the rest for the next call
+    found.clear();
+    m.reset();
+    auto one = [&found](const censor_span& span) {
+        found.push_back(span);
+        return false;
+    };
+    const std::string text = "banned banned banned banned";
+    CHECK(1 == m.feed(text.data(), text.size(), one));
+    CHECK(1 == m.feed(nullptr, 0, one));
+    CHECK(2 == m.finish(one));
+    REQUIRE(4 == found.size());
+    CHECK(21 == found[3].offset);
+}
+
+TEST_CASE("censor stream")
+{
+    std::mt19937 rng(12);
+    std::set<std::string> words;
+    censor c;
+    for (int i = 0; i < 40; ++i) {
+        const std::string w = random_text(rng, 1 + rng() % 4);
+        words.insert(w);
+        c.add_word(w);
+    }
+    c.compile();
+
+    for (size_t chunk : { 1, 3, 7, 64 }) {
+        for (int i = 0; i < 50; ++i) {
+            const std::string text = random_text(rng, rng() % 100);
+            std::string expected = text;
+            c.filter_word(expected);
+
+            memstream source(text.data(), text.size());
+            censor_rstream filter(source, c, '*', chunk);
+            std::string out(text.size(), '\0');
+            CHECK(filter.read(&out[0], out.size()));
+            CHECK(expected == out);
+            char probe;
+            CHECK(!filter.read(&probe, 1));
+            std::string copy = text;
+            CHECK(reference_filter(words, copy) == (filter.matches() > 0));
+        }
+    }
+}
+
+TEST_CASE("censor batch")
+{
+    std::mt19937 rng(7);
+    censor c;
+    for (size_t i = 0; i < 20; ++i)
+        c.add_word(random_text(rng, 1 + rng() % 3));
+    c.compile();
+
+    std::vector<std::string> messages(3000);
+    for (auto& m : messages)
+        m = random_text(rng, rng() % 40);
+
+    for (unsigned threads : { 1, 4 }) {
+        worker_pool pool(threads);
+        std::unique_ptr<bool[]> verdicts(new bool[messages.size()]);
+        c.has_word_batch(messages.data(), messages.size(), verdicts.get(), pool);
+        for (size_t i = 0; i < messages.size(); ++i)
+            REQUIRE(c.has_word(messages[i]) == verdicts[i]);
+
+        auto filtered = messages;
+        std::unique_ptr<bool[]> changed(new bool[messages.size()]);
+        c.filter_word_batch(filtered.data(), filtered.size(), changed.get(), pool, '#');
+        for (size_t i = 0; i < messages.size(); ++i) {
+            auto expect = messages[i];
+            REQUIRE(c.filter_word(expect, '#') == changed[i]);
+            REQUIRE(expect == filtered[i]);
+        }
+
+        auto stars = messages;
+        c.filter_word_batch(stars.data(), stars.size(), nullptr, pool);
+        for (size_t i = 0; i < messages.size(); ++i) {
+            auto expect = messages[i];
+            c.filter_word(expect);
+            REQUIRE(expect == stars[i]);
+        }
+    }
+}
+
+TEST_CASE("censor snapshots")
+{
+    censor_holder holder;
+    CHECK(nullptr == holder.load());
+
+    auto first = make_censor_snapshot({ "one" });
+    CHECK(first->compiled());
+    std::weak_ptr<const censor> weak = first;
+    holder.store(std::move(first));
+
+    auto reader = holder.load();
+    CHECK(reader->has_word("one"));
+    holder.store(make_censor_snapshot({ "two" }));
+    // the old snapshot lives on until its last reader lets go
+    CHECK(!weak.expired());
+    CHECK(reader->has_word("one"));
+    reader.reset();
+    CHECK(weak.expired());
+    CHECK(holder.load()->has_word("two"));
+    CHECK(!holder.load()->has_word("one"));
+}
+
+TEST_CASE("censor snapshots swapped under readers")
+{
+    std::vector<censor_snapshot> snapshots;
+    for (int i = 0; i < 4; ++i)
+        snapshots.push_back(make_censor_snapshot({ "w" + std::to_string(i) }));
+    censor_holder holder(snapshots[0]);
+
+    std::atomic<bool> stop { false };
+    std::atomic<size_t> errors { 0 };
+    std::vector<std::thread> readers;
+    for (int t = 0; t < 4; ++t) {
+        readers.emplace_back([&] {
+            while (!stop) {
+                const auto c = holder.load();
+                int found = 0;
+                for (int i = 0; i < 4; ++i)
+                    found += c->has_word("w" + std::to_string(i)) ? 1 : 0;
+                if (1 != found)
+                    ++errors;
+            }
+        });
+    }
+    for (int i = 0; i < 2000; ++i)
+        holder.store(i % 5 == 0 ? make_censor_snapshot({ "w" + std::to_string(i % 4) }) : snapshots[i % 4]);
+    stop = true;
+    for (auto& t : readers)
+        t.join();
+    CHECK(0 == errors);
+}
+
+TEST_CASE("censor file format")
+{
+    std::mt19937 rng(4);
+    for (int round = 0; round < 50; ++round) {
+        censor c;
+        for (size_t i = 0, n = rng() % 30; i < n; ++i)
+            c.add_word(random_text(rng, 1 + rng() % 5));
+        memstream none;
+        CHECK(!c.save(none));
+        c.compile();
+
+        size_t size = 0;
+        const auto data = saved(c, size);
+        censor_view view;
+        REQUIRE(view.open(data.data(), size));
+        for (int k = 0; k < 30; ++k) {
+            const auto text = random_text(rng, rng() % 100);
+            CHECK(c.has_word(text) == view.has_word(text));
+            auto expect = text;
+            auto filtered = text;
+            CHECK(c.filter_word(expect) == view.filter_word(filtered));
+            CHECK(expect == filtered);
+        }
+    }
+}
+
+TEST_CASE("censor file rejects damaged data")
+{
+    censor c;
+    c.add_word("bad");
+    c.add_word("\xe5\x9d\x8f");
+    c.compile();
+    size_t size = 0;
+    auto data = saved(c, size);
+    censor_view view;
+    CHECK(view.open(data.data(), size));
+    CHECK(!view.open(data.data(), size - 1));
+    CHECK(!view.valid());
+    CHECK(!view.has_word("bad"));
+
+    auto bytes = reinterpret_cast<uint8_t*>(data.data());
+    bytes[sizeof(censor_file_header) + 3] ^= 1;
+    CHECK(!view.open(data.data(), size));
+    CHECK(view.open(data.data(), size, false));
+    bytes[sizeof(censor_file_header) + 3] ^= 1;
+
+    reinterpret_cast<censor_file_header*>(bytes)->version += 1;
+    CHECK(!view.open(data.data(), size));
+    reinterpret_cast<censor_file_header*>(bytes)->version -= 1;
+
+    // links that loop with a valid crc
+    auto header = reinterpret_cast<censor_file_header*>(bytes);
+    auto nodes = reinterpret_cast<censor_file_node*>(header + 1);
+    auto reseal = [&] { header->crc = calc_crc32(nodes, header->nodes * sizeof(censor_file_node)); };
+    REQUIRE(2 == nodes[3].depth); // "ba"
+    const uint32_t fail = nodes[3].fail;
+    nodes[3].fail = 3;
+    reseal();
+    CHECK(!view.open(data.data(), size));
+    // "ba" and "bad" failing to each other
+    const uint32_t child = nodes[3].first;
+    const uint32_t child_fail = nodes[child].fail;
+    nodes[3].fail = child;
+    nodes[child].fail = 3;
+    reseal();
+    CHECK(!view.open(data.data(), size));
+    nodes[child].fail = child_fail;
+    nodes[3].fail = fail;
+    reseal();
+    REQUIRE(view.open(data.data(), size));
+    CHECK(view.has_word("bad"));
+
+    // a depth that does not match the position of the node
+    nodes[3].depth += 1;
+    reseal();
+    CHECK(!view.open(data.data(), size));
+    nodes[3].depth -= 1;
+    reseal();
+    CHECK(view.open(data.data(), size));
+
+    std::vector<uint64_t> shifted(data.size() + 1);
+    std::memcpy(reinterpret_cast<uint8_t*>(shifted.data()) + 1, bytes, size);
+    CHECK(!view.open(reinterpret_cast<uint8_t*>(shifted.data()) + 1, size));
+}
+
+TEST_CASE("censor file mapping")
+{
+    censor c;
+    c.add_word("bad");
+    c.compile();
+    memstream m;
+    REQUIRE(c.save(m));
+
+    const char* path = "censor_test.kcsd";
+    FILE* f = std::fopen(path, "wb");
+    REQUIRE(nullptr != f);
+    CHECK(m.read_size() == std::fwrite(m.read_ptr(), 1, m.read_size(), f));
+    std::fclose(f);
+
+    censor_file file;
+    REQUIRE(file.open(path));
+    CHECK(file.view().has_word("a bad day"));
+    std::string s = "bad";
+    CHECK(file.view().filter_word(s));
+    CHECK("***" == s);
+    file.close();
+    CHECK(!file.view().valid());
+    std::remove(path);
+    CHECK(!file.open(path));
+}
+
+TEST_CASE("censor deep words")
+{
+    // far deeper than the stack could take one frame per node
+    const std::string deep(1 << 20, 'a');
+    std::string text = "x" + deep;
+    {
+        censor c;
+        c.add_word(deep);
+        c.add_word("ab");
+        CHECK(c.has_word(text));
+        CHECK(!c.has_word("aaaa"));
+        c.compile();
+        CHECK(c.filter_word(text));
+        CHECK('x' == text[0]);
+        CHECK(std::string(deep.size(), '*') == text.substr(1));
+    }
+}
+
+TEST_CASE("censor memory")
+{
+    // 3 byte characters as in a cjk dictionary
+    std::mt19937 rng(2);
+    censor c;
+    const size_t words = 20000;
+    size_t bytes = 0;
+    for (size_t i = 0; i < words; ++i) {
+        std::string w;
+        for (size_t k = 0, n = 2 + rng() % 4; k < n; ++k) {
+            const uint32_t cp = 0x4e00 + rng() % 3000;
+            w += static_cast<char>(0xe0 | (cp >> 12));
+            w += static_cast<char>(0x80 | ((cp >> 6) & 0x3f));
+            w += static_cast<char>(0x80 | (cp & 0x3f));
+        }
+        bytes += w.size();
+        c.add_word(w);
+    }
+    const size_t usage = c.memory_usage();
+    MESSAGE("censor: " << words << " words, " << bytes << " bytes, " << usage / words << " bytes per word");
+    // far below one 2 KB node per byte
+    CHECK(usage / words < 2048);
+}
@@ -0,0 +1,257 @@
+#define DOCTEST_CONFIG_IMPLEMENT_WITH_MAIN
+#include "../doctest.h"
+#include "../../src/kcrc32batch.h"
+#include <kcrc32.h>
+#include <kcrcstream.h>
+#include <kserializer.h>
+#include <algorithm>
+#include <random>
+#include <vector>
+
+TEST_SUITE_BEGIN("crc32");
+using namespace klib;
+
+namespace {
+
+// bit-at-a-time reference, independent of every table and simd engine
+uint32_t reference_crc32(const void* data, size_t size)
+{
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    uint32_t crc = 0xffffffff;
+    for (size_t i = 0; i < size; ++i) {
+        crc ^= p[i];
+        for (int k = 0; k < 8; ++k)
+            crc = (crc >> 1) ^ (0xedb88320 & (0 - (crc & 1)));
+    }
+    return crc ^ 0xffffffff;
+}
+
+std::vector<uint8_t> random_bytes(size_t size, uint32_t seed)
+{
+    std::mt19937 rng(seed);
+    std::vector<uint8_t> data(size);
+    for (auto& c : data)
+        c = static_cast<uint8_t>(rng());
+    return data;
+}
+
+} // namespace
+
+TEST_CASE("check values")
+{
+    CHECK(0x00000000 == calc_crc32("", 0));
+    CHECK(0xcbf43926 == calc_crc32("123456789", 9));
+    CHECK(0x414fa339 == calc_crc32("The quick brown fox jumps over the lazy dog", 43));
+}
+
+TEST_CASE("crc_engine check values")
+{
+    using crc8 = crc_engine<uint8_t, 0x07, false, 0x00, 0x00>;
+    using crc16_ccitt_false = crc_engine<uint16_t, 0x1021, false, 0xffff, 0x0000>;
+    using crc32_bzip2 = crc_engine<uint32_t, 0x04c11db7, false, 0xffffffff, 0xffffffff>;
+    using crc64_xz = crc_engine<uint64_t, 0x42f0e1eba9ea3693, true, ~0ull, ~0ull>;
+
+    CHECK(0xf4 == crc8::calc("123456789", 9));
+    CHECK(0x29b1 == crc16_ccitt_false::calc("123456789", 9));
+    CHECK(0xfc891918 == crc32_bzip2::calc("123456789", 9));
+    CHECK(0x995dc9bbdf1939fa == crc64_xz::calc("123456789", 9));
+    CHECK(0xcbf43926 == crc32_engine::calc("123456789", 9));
+    CHECK(0xe3069283 == crc32c_engine::calc("123456789", 9));
+    CHECK(0xe3069283 == calc_crc32c("123456789", 9));
+
+    static_assert(0x77073096 == crc32_engine::table().slice[0][1], "crc32 table");
+}
+
+TEST_CASE("crc32c matches the table engine")
+{
+    const auto data = random_bytes(1 << 16, 8);
+    std::mt19937 rng(9);
+    for (int i = 0; i < 500; ++i) {
+        const size_t offset = rng() % 64;
+        const size_t size = rng() % (i < 250 ? 64 : data.size() - offset);
+        REQUIRE(crc32c_engine::calc(&data[offset], size) == calc_crc32c(&data[offset], size));
+    }
+}
+
+namespace {
+
+template <uint32_t Id>
+struct message_id {
+    static constexpr uint32_t value = Id;
+};
+
+int dispatch(uint32_t id)
+{
+    switch (id) {
+    case crc32_literal("LoginReq"):
+        return 1;
+    case crc32_literal("LogoutReq"):
+        return 2;
+    default:
+        return 0;
+    }
+}
+
+} // namespace
+
+TEST_CASE("crc32_literal")
+{
+    static_assert(0xcbf43926 == crc32_literal("123456789"), "check value");
+    static_assert(0 == crc32_literal(""), "empty");
+    static_assert(crc32_literal("LoginReq") == message_id<crc32_literal("LoginReq")>::value, "template argument");
+
+    CHECK(calc_crc32("LoginReq", 8) == crc32_literal("LoginReq"));
+    CHECK(1 == dispatch(calc_crc32("LoginReq", 8)));
+    CHECK(2 == dispatch(calc_crc32("LogoutReq", 9)));
+    CHECK(0 == dispatch(calc_crc32("Unknown", 7)));
+
+    const std::string name = "a longer message type name used as a key";
+    CHECK(calc_crc32(name.data(), name.size()) == crc32_literal("a longer message type name used as a key"));
+}
+
+TEST_CASE("every length up to 1024")
+{
+    const auto data = random_bytes(1024, 1);
+    for (size_t n = 0; n <= data.size(); ++n)
+        REQUIRE(reference_crc32(data.data(), n) == calc_crc32(data.data(), n));
+}
+
+TEST_CASE("random lengths and alignments")
+{
+    const auto data = random_bytes(1 << 18, 2);
+    std::mt19937 rng(3);
+    for (int i = 0; i < 200; ++i) {
+        const size_t offset = rng() % 64;
+        const size_t size = rng() % (data.size() - offset);
+        REQUIRE(reference_crc32(&data[offset], size) == calc_crc32(&data[offset], size));
+    }
+}
+
+TEST_CASE("calc_crc32_batch")
+{
+    const auto data = random_bytes(1 << 16, 10);
+    std::mt19937 rng(11);
+    for (size_t count : { 0, 1, 3, 4, 5, 17, 1000 }) {
+        std::vector<crc32_buffer> buffers(count);
+        for (auto& b : buffers) {
+            b.size = rng() % (rng() % 4 ? 600 : 20);
+            b.data = &data[rng() % (data.size() - b.size)];
+        }
+        std::vector<uint32_t> crcs(count);
+        calc_crc32_batch(buffers.data(), count, crcs.data());
+        for (size_t i = 0; i < count; ++i)
+            REQUIRE(calc_crc32(buffers[i].data, buffers[i].size) == crcs[i]);
+    }
+}
+
+TEST_CASE("crc32_batch_table")
+{
+    // calc_crc32_batch takes the clmul kernel where it can
+    const auto data = random_bytes(1 << 16, 14);
+    std::mt19937 rng(15);
+    for (size_t count : { 0, 1, 3, 4, 5, 17, 1000 }) {
+        std::vector<crc32_buffer> buffers(count);
+        for (auto& b : buffers) {
+            b.size = rng() % (rng() % 4 ? 600 : 20);
+            b.data = &data[rng() % (data.size() - b.size)];
+        }
+        std::vector<uint32_t> crcs(count);
+        crc32_batch_table(buffers.data(), count, crcs.data());
+        for (size_t i = 0; i < count; ++i)
+            REQUIRE(calc_crc32(buffers[i].data, buffers[i].size) == crcs[i]);
+    }
+}
+
+TEST_CASE("calc_crc32 over segments")
+{
+    const auto data = random_bytes(4096, 12);
+    std::mt19937 rng(13);
+    std::vector<crc32_buffer> buffers;
+    for (size_t pos = 0; pos < data.size();) {
+        const size_t size = std::min<size_t>(rng() % 200, data.size() - pos);
+        buffers.push_back({ &data[pos], size });
+        pos += size;
+    }
+    CHECK(calc_crc32(data.data(), data.size()) == calc_crc32_buffers(buffers.data(), buffers.size()));
+    CHECK(0 == calc_crc32_buffers(buffers.data(), 0));
+    CHECK(calc_crc32(nullptr, 0) == calc_crc32(data.data(), 0));
+
+#ifndef _WIN32
+    std::vector<struct iovec> iov(buffers.size());
+    for (size_t i = 0; i < buffers.size(); ++i) {
+        iov[i].iov_base = const_cast<void*>(buffers[i].data);
+        iov[i].iov_len = buffers[i].size;
+    }
+    CHECK(calc_crc32(data.data(), data.size()) == calc_crc32_iov(iov.data(), iov.size()));
+#endif
+}
+
+TEST_CASE("crc32_state")
+{
+    const auto data = random_bytes(4096, 4);
+    std::mt19937 rng(5);
+    crc32_state state;
+    for (size_t pos = 0; pos < data.size();) {
+        const size_t size = std::min<size_t>(rng() % 300, data.size() - pos);
+        state.update(&data[pos], size);
+        pos += size;
+    }
+    CHECK(calc_crc32(data.data(), data.size()) == state.finalize());
+
+    state.reset();
+    CHECK(0 == state.finalize());
+    state.update("123456789", 9);
+    CHECK(0xcbf43926 == state.finalize());
+}
+
+TEST_CASE("crc32_combine")
+{
+    const auto data = random_bytes(1 << 16, 6);
+    std::mt19937 rng(7);
+    for (int i = 0; i < 100; ++i) {
+        const size_t split = rng() % data.size();
+        const uint32_t a = calc_crc32(data.data(), split);
+        const uint32_t b = calc_crc32(&data[split], data.size() - split);
+        REQUIRE(calc_crc32(data.data(), data.size()) == crc32_combine(a, b, data.size() - split));
+    }
+    CHECK(0x12345678 == crc32_combine(0x12345678, 0, 0));
+}
+
+TEST_CASE("crc_wstream and crc_rstream")
+{
+    const std::string text = "checksummed while it flows";
+    memstream m;
+    {
+        crc_wstream cs(m);
+        wserializer s(cs);
+        CHECK((s & text));
+        CHECK((s & uint64_t(0x123456789)));
+        CHECK(cs.write<uint8_t>(7));
+        CHECK(calc_crc32(m.read_ptr(), m.read_size()) == cs.crc());
+        CHECK(cs.write_crc());
+    }
+
+    memstream corrupt(m);
+    {
+        crc_rstream cs(m);
+        rserializer s(cs);
+        std::string str;
+        uint64_t u64 = 0;
+        uint8_t u8 = 0;
+        CHECK((s & str));
+        CHECK((s & u64));
+        CHECK(cs.read(u8));
+        CHECK(text == str);
+        CHECK(0x123456789 == u64);
+        CHECK(7 == u8);
+        CHECK(cs.check_crc());
+        CHECK(0 == m.read_size());
+    }
+
+    corrupt.read_ptr()[3] ^= 0x20;
+    {
+        crc_rstream cs(corrupt);
+        CHECK(cs.discard(corrupt.read_size() - 4));
+        CHECK(!cs.check_crc());
+    }
+}